@@ -9,10 +9,22 @@
 #include <filesystem>
 #include <unordered_map>
 #include <algorithm>
+#include <chrono>
+#include <array>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "../stats.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
+// The LAB10 JackTokenizer, for --stream; its main() stays inside the namespace.
+namespace scan {
+#include "tokenizer.cpp"
+}
+
 enum TokenType { T_KEYWORD, T_SYMBOL, T_IDENTIFIER, T_INT_CONST, T_STRING_CONST };
 
 enum KeywordType {
@@ -21,29 +33,31 @@ enum KeywordType {
     K_FALSE, K_NULL, K_THIS
 };
 
+// The whole *T.xml file is scanned once into an array of tokens; advancing and
+// peeking are then just index moves.
 class Tokenizer {
 public:
-    ifstream curr;
-    string currToken;
-    TokenType token{};
-    KeywordType keywordType{};
+    struct Token {
+        TokenType type;
+        KeywordType kw;
+        string text;
+    };
 
     Tokenizer(const string& filename);
 
-    bool hasMoreTokens();
+    bool hasMoreTokens() const { return next_ < tokens_.size(); }
     void advance();
 
-    string peekNextToken();
+    const string& peekNextToken() const;
 
-    TokenType tokenType() { return token; }
-    KeywordType keyword() { return keywordType; }
-    char symbol() { return currToken.empty() ? '\0' : currToken[0]; }
-    string identifier() { return currToken; }
-    int intVal() { return atoi(currToken.c_str()); }
-    string stringVal() { return currToken; }
-    string getCurrentToken() { return currToken; }
-
-    string getNextXmlToken();
+    TokenType tokenType() const { return token; }
+    KeywordType keyword() const { return keywordType; }
+    char symbol() const { return currToken.empty() ? '\0' : currToken[0]; }
+    const string& identifier() const { return currToken; }
+    int intVal() const { return atoi(currToken.c_str()); }
+    const string& stringVal() const { return currToken; }
+    const string& getCurrentToken() const { return currToken; }
+    size_t size() const { return tokens_.size(); }
 
     static string unescapeXml(const string& s) {
         if (s == "&lt;") return "<";
@@ -54,55 +68,32 @@ public:
     }
 
 private:
-    unordered_map<string, KeywordType> keywordMap;
-    unordered_map<string, TokenType>   tagMap;
-
-    static inline void skipWs(ifstream& in) {
-        while (in && isspace(in.peek())) in.get();
-    }
-
-    static string readXmlChunk(ifstream& in) {
-        skipWs(in);
-        string out;
-        if (!in) return out;
-        int pk = in.peek();
-        if (pk == EOF) return out;
-        if (static_cast<char>(pk) == '<') {
-            char c;
-            while (in.get(c)) {
-                out.push_back(c);
-                if (c == '>') break;
-            }
-            return out;
-        } else {
-            char c;
-            while (in && in.peek() != '<' && in.get(c)) out.push_back(c);
-            size_t end = out.find_last_not_of(" \t\r\n");
-            if (end != string::npos) out.erase(end + 1);
-            while (!out.empty() && isspace(static_cast<unsigned char>(out.front())))
-                out.erase(out.begin());
-            return out;
-        }
-    }
-
-    static string stripTagBrackets(const string& tag) {
-        if (tag.size() >= 2 && tag.front() == '<' && tag.back() == '>')
-            return tag.substr(1, tag.size() - 2);
-        return tag;
-    }
+    vector<Token> tokens_;
+    size_t next_{0};
+    string currToken;
+    TokenType token{};
+    KeywordType keywordType{};
 
-    string peekNextTag() {
-        streampos pos = curr.tellg();
-        string t = readXmlChunk(curr);
-        curr.clear();
-        curr.seekg(pos);
-        return t;
-    }
+    void load(const string& xml);
 };
 
 Tokenizer::Tokenizer(const string& filename) {
-    curr.open(filename);
-    keywordMap = {
+    Stats& stats = Stats::get();
+    string xml;
+    {
+        auto timer = stats.time("read");
+        ifstream in(filename, ios::binary);
+        xml.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    stats.add("bytes_in", static_cast<long long>(xml.size()));
+    auto timer = stats.time("tokenize");
+    load(xml);
+    stats.add("tokens", static_cast<long long>(tokens_.size()));
+}
+
+// <tag> text </tag> per token; the text is trimmed, and symbols are unescaped.
+void Tokenizer::load(const string& xml) {
+    static const unordered_map<string, KeywordType> keywordMap = {
         {"class", K_CLASS}, {"constructor", K_CONSTRUCTOR}, {"function", K_FUNCTION},
         {"method", K_METHOD}, {"field", K_FIELD}, {"static", K_STATIC}, {"var", K_VAR},
         {"int", K_INT}, {"char", K_CHAR}, {"boolean", K_BOOLEAN}, {"void", K_VOID},
@@ -110,62 +101,139 @@ Tokenizer::Tokenizer(const string& filename) {
         {"let", K_LET}, {"do", K_DO}, {"if", K_IF}, {"else", K_ELSE},
         {"while", K_WHILE}, {"return", K_RETURN}
     };
-    tagMap = {
+    static const unordered_map<string, TokenType> tagMap = {
         {"keyword", T_KEYWORD},
         {"symbol", T_SYMBOL},
         {"identifier", T_IDENTIFIER},
         {"integerConstant", T_INT_CONST},
         {"stringConstant", T_STRING_CONST}
     };
-    (void)getNextXmlToken();
-}
-
-bool Tokenizer::hasMoreTokens() {
-    if (!curr) return false;
-    string nxt = peekNextTag();
-    return nxt != "</tokens>" && !nxt.empty();
+    tokens_.reserve(xml.size() / 32);
+    string tag;
+    size_t i = 0, n = xml.size();
+    while ((i = xml.find('<', i)) != string::npos) {
+        size_t close = xml.find('>', i);
+        if (close == string::npos) break;
+        tag.assign(xml, i + 1, close - i - 1);
+        i = close + 1;
+        if (tag == "/tokens") break;
+        auto itType = tagMap.find(tag);
+        if (itType == tagMap.end()) continue;
+        size_t end = xml.find('<', i);
+        if (end == string::npos) end = n;
+        size_t b = i, e = end;
+        while (b < e && isspace(static_cast<unsigned char>(xml[b]))) ++b;
+        while (e > b && isspace(static_cast<unsigned char>(xml[e - 1]))) --e;
+        Token t{itType->second, K_CLASS, xml.substr(b, e - b)};
+        if (t.type == T_SYMBOL) t.text = unescapeXml(t.text);
+        if (t.type == T_KEYWORD) {
+            auto itKw = keywordMap.find(t.text);
+            if (itKw != keywordMap.end()) t.kw = itKw->second;
+        }
+        tokens_.push_back(move(t));
+        i = end;
+        // skip the closing tag
+        if (i < n && xml.compare(i, 2, "</") == 0) {
+            size_t c = xml.find('>', i);
+            i = (c == string::npos) ? n : c + 1;
+        }
+    }
 }
 
 void Tokenizer::advance() {
     if (!hasMoreTokens()) return;
-    string openTag = readXmlChunk(curr);
-    string tagName = stripTagBrackets(openTag);
-    currToken = readXmlChunk(curr);
-    auto itType = tagMap.find(tagName);
-    if (itType != tagMap.end()) token = itType->second;
-    if (token == T_SYMBOL) currToken = unescapeXml(currToken);
-    if (token == T_KEYWORD) {
-        auto itKw = keywordMap.find(currToken);
-        if (itKw != keywordMap.end()) keywordType = itKw->second;
-    }
-    (void)readXmlChunk(curr);
+    const Token& t = tokens_[next_++];
+    token = t.type;
+    if (t.type == T_KEYWORD) keywordType = t.kw;
+    currToken = t.text;
 }
 
-string Tokenizer::peekNextToken() {
-    streampos pos = curr.tellg();
-    string value;
-    if (hasMoreTokens()) {
-        string openTag = readXmlChunk(curr);
-        value = readXmlChunk(curr);
-        if (openTag.find("symbol") != string::npos) value = unescapeXml(value);
-        (void)readXmlChunk(curr);
-    }
-    curr.clear();
-    curr.seekg(pos);
-    return value;
+const string& Tokenizer::peekNextToken() const {
+    static const string none;
+    return hasMoreTokens() ? tokens_[next_].text : none;
 }
 
-string Tokenizer::getNextXmlToken() {
-    return readXmlChunk(curr);
-}
+// Tokens scanned from a .jack file on a producer thread and handed over through
+// a bounded ring, so neither side ever holds more than kRing tokens.
+class TokenStream {
+public:
+    explicit TokenStream(const string& jackFile) : ring_(kRing) {
+        producer_ = thread([this, jackFile] { produce(jackFile); });
+    }
+    ~TokenStream() { producer_.join(); }
+
+    bool hasMoreTokens() {
+        unique_lock<mutex> lk(m_);
+        cv_.wait(lk, [&] { return head_ > tail_ || done_; });
+        return head_ > tail_;
+    }
+    void advance() {
+        unique_lock<mutex> lk(m_);
+        cv_.wait(lk, [&] { return head_ > tail_ || done_; });
+        if (head_ == tail_) return;
+        Slot& s = ring_[tail_ % kRing];
+        token = s.type;
+        swap(currToken, s.text);
+        if (head_ - tail_++ == kRing) cv_.notify_one();
+    }
+    const string& peekNextToken() {
+        static const string none;
+        unique_lock<mutex> lk(m_);
+        cv_.wait(lk, [&] { return head_ > tail_ || done_; });
+        return head_ > tail_ ? ring_[tail_ % kRing].text : none;
+    }
+
+    TokenType tokenType() const { return token; }
+    char symbol() const { return currToken.empty() ? '\0' : currToken[0]; }
+    const string& identifier() const { return currToken; }
+    int intVal() const { return atoi(currToken.c_str()); }
+    const string& stringVal() const { return currToken; }
+    const string& getCurrentToken() const { return currToken; }
+
+private:
+    struct Slot {
+        TokenType type;
+        string text;
+    };
+    static constexpr size_t kRing = 1024;
+    vector<Slot> ring_;
+    size_t head_{0}, tail_{0};     // tokens produced / consumed so far
+    bool done_{false};
+    mutex m_;
+    condition_variable cv_;        // only one side can be waiting at a time
+    thread producer_;
+    string currToken;
+    TokenType token{};
 
+    void produce(const string& jackFile) {
+        auto timer = Stats::get().time("tokenize");
+        scan::JackTokenizer tz(jackFile);
+        while (tz.hasMoreTokens()) {
+            tz.advance();
+            unique_lock<mutex> lk(m_);
+            cv_.wait(lk, [&] { return head_ - tail_ < kRing; });
+            Slot& s = ring_[head_ % kRing];
+            s.type = static_cast<TokenType>(tz.tokenType());
+            s.text = tz.getCurrentToken();
+            if (head_++ == tail_) cv_.notify_one();
+        }
+        Stats::get().add("tokens", static_cast<long long>(head_));
+        lock_guard<mutex> lk(m_);
+        done_ = true;
+        cv_.notify_one();
+    }
+};
+
+// Parse tree XML for one file; lines are indented from a fixed table and the
+// text goes out through the tokenizer's chunked XmlWriter.
+template <class Source>
 class Parser {
 public:
-    Tokenizer* tokenizer;
-    ofstream* outFile;
+    Source* tokenizer;
+    scan::XmlWriter* out;
     int indentLevel{0};
 
-    Parser(Tokenizer* t, ofstream* o) : tokenizer(t), outFile(o) {}
+    Parser(Source* t, scan::XmlWriter* o) : tokenizer(t), out(o) {}
 
     void compileClass() {
         openNonTerm("class");
@@ -198,40 +266,42 @@ private:
         return s == "-" || s == "~";
     }
 
-    void indent() { (*outFile) << string(indentLevel * 2, ' '); }
+    void indent() {
+        static const string spaces(256, ' ');
+        size_t n = static_cast<size_t>(indentLevel) * 2;
+        while (n > spaces.size()) { out->raw(spaces); n -= spaces.size(); }
+        out->raw(spaces.data(), n);
+    }
 
-    void openNonTerm(const string& tag) {
-        indent(); (*outFile) << "<" << tag << ">\n";
+    void openNonTerm(const char* tag) {
+        indent();
+        out->raw("<", 1); out->raw(tag, strlen(tag)); out->raw(">\n", 2);
         ++indentLevel;
     }
 
-    void closeNonTerm(const string& tag) {
+    void closeNonTerm(const char* tag) {
         --indentLevel;
-        indent(); (*outFile) << "</" << tag << ">\n";
+        indent();
+        out->raw("</", 2); out->raw(tag, strlen(tag)); out->raw(">\n", 2);
     }
 
     void emitCurrentToken() {
         indent();
         switch (tokenizer->tokenType()) {
             case T_KEYWORD:
-                (*outFile) << "<keyword> " << tokenizer->getCurrentToken() << " </keyword>\n";
+                out->element("keyword", 7, tokenizer->getCurrentToken());
                 break;
-            case T_SYMBOL: {
-                char s = tokenizer->symbol();
-                if (s == '<')      (*outFile) << "<symbol> &lt; </symbol>\n";
-                else if (s == '>') (*outFile) << "<symbol> &gt; </symbol>\n";
-                else if (s == '&') (*outFile) << "<symbol> &amp; </symbol>\n";
-                else               (*outFile) << "<symbol> " << s << " </symbol>\n";
+            case T_SYMBOL:
+                out->symbol(tokenizer->symbol());
                 break;
-            }
             case T_IDENTIFIER:
-                (*outFile) << "<identifier> " << tokenizer->identifier() << " </identifier>\n";
+                out->element("identifier", 10, tokenizer->identifier());
                 break;
             case T_INT_CONST:
-                (*outFile) << "<integerConstant> " << tokenizer->intVal() << " </integerConstant>\n";
+                out->element("integerConstant", 15, to_string(tokenizer->intVal()));
                 break;
             case T_STRING_CONST:
-                (*outFile) << "<stringConstant> " << tokenizer->stringVal() << " </stringConstant>\n";
+                out->element("stringConstant", 14, tokenizer->stringVal());
                 break;
         }
         if (tokenizer->hasMoreTokens()) tokenizer->advance();
@@ -435,7 +505,7 @@ private:
             compileTerm();
         }
         else if (tokenizer->tokenType() == T_IDENTIFIER) {
-            string look = tokenizer->peekNextToken();
+            const string& look = tokenizer->peekNextToken();
             if (look == "[") {
                 parseIdentifier();
                 expect("[");
@@ -479,14 +549,90 @@ static bool endsWith(const string& s, const string& suf) {
            equal(suf.rbegin(), suf.rend(), s.rbegin());
 }
 
+static void parseFile(const string& xmlTokenFile, const string& outPath) {
+    Tokenizer tokenizer(xmlTokenFile);
+    scan::XmlWriter out(outPath);
+    Parser<Tokenizer> parser(&tokenizer, &out);
+    auto timer = Stats::get().time("parse");
+    parser.compileClass();
+}
+
+// Foo.jack -> myFoo.xml, the name the tokenizer-then-parser route produces.
+static void streamFile(const fs::path& jackFile) {
+    TokenStream tokens(jackFile.string());
+    scan::XmlWriter out(jackFile.parent_path() / ("my" + jackFile.stem().string() + ".xml"));
+    Parser<TokenStream> parser(&tokens, &out);
+    auto timer = Stats::get().time("parse");
+    parser.compileClass();
+    while (tokens.hasMoreTokens()) tokens.advance();   // let the scanner finish
+}
+
+// Parses a synthetic class made of the subroutines of fileT.xml repeated `copies`
+// times, and reports load-and-parse throughput.
+static int bench(const string& xmlTokenFile, int copies) {
+    ifstream in(xmlTokenFile, ios::binary);
+    string xml((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    size_t first = string::npos;
+    for (const char* kw : {"constructor", "function", "method"})
+        first = min(first, xml.find(string("<keyword> ") + kw + " </keyword>"));
+    size_t last = xml.rfind("<symbol> } </symbol>");
+    if (first == string::npos || last == string::npos || last < first) {
+        cerr << "no subroutines in " << xmlTokenFile << "\n";
+        return 1;
+    }
+    string big = xml.substr(0, first);
+    for (int i = 0; i < copies; ++i) big.append(xml, first, last - first);
+    big += xml.substr(last);
+    fs::path dir = fs::temp_directory_path();
+    string inPath = (dir / "parserBenchT.xml").string(), outPath = (dir / "parserBench.xml").string();
+    ofstream(inPath, ios::binary) << big;
+
+    double best = 1e30;
+    size_t tokens = Tokenizer(inPath).size();
+    for (int r = 0; r < 3; ++r) {
+        auto t0 = chrono::steady_clock::now();
+        parseFile(inPath, outPath);
+        best = min(best, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+    }
+    double mb = big.size() / 1048576.0;
+    cout << mb << " MB, " << tokens << " tokens: " << best * 1e3 << " ms, "
+         << mb / best << " MB/s, " << tokens / best / 1e6 << " Mtokens/s\n";
+    fs::remove(inPath);
+    fs::remove(outPath);
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " [fileT.xml | directoryName]\n";
+    Stats& stats = Stats::get();
+    vector<string> args;
+    for (int i = 1; i < argc; ++i)
+        if (!stats.parseFlag(argv[i], "parser")) args.push_back(argv[i]);
+    if (args.size() == 2 && args[0].rfind("--bench", 0) == 0) {
+        const string& a = args[0];
+        return bench(args[1], a.size() > 8 && a[7] == '=' ? max(1, atoi(a.c_str() + 8)) : 1000);
+    }
+    if (args.size() == 2 && args[0] == "--stream") {
+        fs::path input(args[1]);
+        vector<fs::path> jackFiles;
+        if (fs::is_directory(input)) {
+            for (const auto& entry : fs::directory_iterator(input))
+                if (entry.is_regular_file() && entry.path().extension() == ".jack") jackFiles.push_back(entry.path());
+        } else if (input.extension() == ".jack") {
+            jackFiles.push_back(input);
+        }
+        for (const auto& f : jackFiles) streamFile(f);
+        stats.add("files", static_cast<long long>(jackFiles.size()));
+        return 0;
+    }
+    if (args.size() != 1) {
+        cerr << "Usage: " << argv[0] << " [--stats[=text|json][:file]] [fileT.xml | directoryName]\n"
+             << "       " << argv[0] << " --stream [fileName.jack | directoryName]\n"
+             << "       " << argv[0] << " --bench[=copies] fileT.xml\n";
         return 1;
     }
-    fs::path inputPath(argv[1]);
+    fs::path inputPath(args[0]);
     vector<string> filesToProcess;
     if (fs::is_directory(inputPath)) {
         for (const auto& entry : fs::directory_iterator(inputPath)) {
@@ -504,11 +650,8 @@ int main(int argc, char* argv[]) {
         string stem = p.stem().string();
         string finalStem = (stem.empty() ? stem : stem.substr(0, stem.size() - 1));
         string outPath = (parent / (finalStem + ".xml")).string();
-        Tokenizer tokenizer(xmlTokenFile);
-        ofstream out(outPath);
-        Parser parser(&tokenizer, &out);
-        parser.compileClass();
-        out.close();
+        parseFile(xmlTokenFile, outPath);
     }
+    stats.add("files", static_cast<long long>(filesToProcess.size()));
     return 0;
 }
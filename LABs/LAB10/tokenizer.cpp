@@ -7,8 +7,9 @@
 #include <cctype>
 #include <cstdlib>
 #include <filesystem>
-#include <unordered_map>
-#include <unordered_set>
+#include <array>
+#include <cstring>
+#include "../stats.h"
 
 using namespace std;
 namespace fs = std::filesystem;
@@ -23,6 +24,22 @@ enum KeywordType {
     K_FALSE, K_NULL, K_THIS
 };
 
+// Byte classes for the scanner; one table lookup replaces the isspace/isalpha
+// calls and the symbol set.
+enum : uint8_t { C_SPACE = 1, C_SYM = 2, C_DIGIT = 4, C_IDSTART = 8, C_IDCHAR = 16 };
+
+static constexpr array<uint8_t, 256> makeClassTable() {
+    array<uint8_t, 256> t{};
+    for (unsigned char c : {' ', '\t', '\n', '\v', '\f', '\r'}) t[c] = C_SPACE;
+    for (unsigned char c : {'{','}','(',')','[',']','.',',',';','+','-','*','/','&','|','<','>','=','~'}) t[c] = C_SYM;
+    for (int c = '0'; c <= '9'; ++c) t[c] = C_DIGIT | C_IDCHAR;
+    for (int c = 'a'; c <= 'z'; ++c) t[c] = C_IDSTART | C_IDCHAR;
+    for (int c = 'A'; c <= 'Z'; ++c) t[c] = C_IDSTART | C_IDCHAR;
+    t['_'] = C_IDSTART | C_IDCHAR;
+    return t;
+}
+static constexpr array<uint8_t, 256> kClass = makeClassTable();
+
 class JackTokenizer {
 public:
     explicit JackTokenizer(const string& filename);
@@ -33,157 +50,216 @@ public:
     TokenType tokenType() const { return tok_; }
     KeywordType keyword() const { return kw_; }
     char symbol() const { return curr_.empty() ? '\0' : curr_[0]; }
-    string identifier() const { return curr_; }
+    const string& identifier() const { return curr_; }
     int intVal() const { return atoi(curr_.c_str()); }
-    string stringVal() const { return curr_; }
-    string getCurrentToken() const { return curr_; }
+    const string& stringVal() const { return curr_; }
+    const string& getCurrentToken() const { return curr_; }
 
 private:
+    // The source is read in fixed blocks; pos_..end_ is the unread part of buf_.
+    static constexpr size_t kBlock = 1 << 16;
     ifstream in_;
+    vector<char> buf_;
+    size_t pos_{0}, end_{0};
+    bool eof_{false};
     string curr_;
     TokenType tok_;
     KeywordType kw_;
-    unordered_map<string, KeywordType> kwMap_;
-    unordered_set<char> sym_;
 
+    static bool keywordOf(const string& w, KeywordType& kw);
+    bool fill(size_t need) { return end_ - pos_ >= need || refill(need); }
+    bool refill(size_t need);
+    int peekAt(size_t k) { return fill(k + 1) ? static_cast<unsigned char>(buf_[pos_ + k]) : EOF; }
     void skipTrivia();
-    inline bool isSym(char c) const { return sym_.find(c) != sym_.end(); }
+    void skipLine();
+    void skipBlock();
 };
 
-JackTokenizer::JackTokenizer(const string& filename) : tok_(T_SYMBOL), kw_(K_CLASS) {
-    in_.open(filename);
-    kwMap_ = {
-        {"class", K_CLASS}, {"constructor", K_CONSTRUCTOR}, {"function", K_FUNCTION},
-        {"method", K_METHOD}, {"field", K_FIELD}, {"static", K_STATIC}, {"var", K_VAR},
-        {"int", K_INT}, {"char", K_CHAR}, {"boolean", K_BOOLEAN}, {"void", K_VOID},
-        {"true", K_TRUE}, {"false", K_FALSE}, {"null", K_NULL}, {"this", K_THIS},
-        {"let", K_LET}, {"do", K_DO}, {"if", K_IF}, {"else", K_ELSE},
-        {"while", K_WHILE}, {"return", K_RETURN}
+JackTokenizer::JackTokenizer(const string& filename)
+    : in_(filename, ios::binary), buf_(kBlock), tok_(T_SYMBOL), kw_(K_CLASS) {}
+
+// Keywords by length and first letter, so most identifiers cost one or two compares.
+bool JackTokenizer::keywordOf(const string& w, KeywordType& kw) {
+    struct Entry { const char* text; KeywordType kw; };
+    static const vector<Entry> byLength[12] = {
+        {}, {},
+        {{"do", K_DO}, {"if", K_IF}},
+        {{"int", K_INT}, {"var", K_VAR}, {"let", K_LET}},
+        {{"char", K_CHAR}, {"void", K_VOID}, {"true", K_TRUE}, {"null", K_NULL}, {"this", K_THIS}, {"else", K_ELSE}},
+        {{"class", K_CLASS}, {"field", K_FIELD}, {"false", K_FALSE}, {"while", K_WHILE}},
+        {{"method", K_METHOD}, {"static", K_STATIC}, {"return", K_RETURN}},
+        {{"boolean", K_BOOLEAN}},
+        {{"function", K_FUNCTION}},
+        {}, {},
+        {{"constructor", K_CONSTRUCTOR}}
     };
-    sym_ = {'{','}','(',')','[',']','.',',',';','+','-','*','/','&','|','<','>','=','~'};
+    if (w.size() >= 12) return false;
+    for (const Entry& e : byLength[w.size()])
+        if (e.text[0] == w[0] && w.compare(e.text) == 0) { kw = e.kw; return true; }
+    return false;
+}
+
+// Makes at least `need` unread bytes available unless the file ends first.
+bool JackTokenizer::refill(size_t need) {
+    auto timer = Stats::get().time("read");
+    while (end_ - pos_ < need && !eof_) {
+        if (pos_ > 0) {
+            memmove(buf_.data(), buf_.data() + pos_, end_ - pos_);
+            end_ -= pos_;
+            pos_ = 0;
+        }
+        if (buf_.size() - end_ < kBlock) buf_.resize(end_ + kBlock);
+        in_.read(buf_.data() + end_, static_cast<streamsize>(buf_.size() - end_));
+        end_ += static_cast<size_t>(in_.gcount());
+        Stats::get().add("bytes_in", in_.gcount());
+        if (in_.gcount() == 0) eof_ = true;
+    }
+    return end_ - pos_ >= need;
 }
 
 bool JackTokenizer::hasMoreTokens() {
     skipTrivia();
-    return in_ && in_.peek() != EOF;
+    return fill(1);
 }
 
 void JackTokenizer::advance() {
     if (!hasMoreTokens()) return;
 
     curr_.clear();
-    int p = in_.peek();
-    if (p == EOF) return;
-    char c = static_cast<char>(p);
+    char c = buf_[pos_];
+    uint8_t k = kClass[static_cast<unsigned char>(c)];
 
-    if (isSym(c)) {
+    if (k & C_SYM) {
         tok_ = T_SYMBOL;
-        curr_.push_back(static_cast<char>(in_.get()));
+        curr_.push_back(c);
+        ++pos_;
         return;
     }
 
     if (c == '"') {
         tok_ = T_STRING_CONST;
-        in_.get();
-        while (in_ && in_.peek() != '"' && in_.peek() != '\n' && in_.peek() != EOF) {
-            curr_.push_back(static_cast<char>(in_.get()));
+        ++pos_;
+        for (;;) {
+            if (!fill(1)) return;
+            const char* b = buf_.data() + pos_;
+            size_t n = 0;
+            while (n < end_ - pos_ && b[n] != '"' && b[n] != '\n') ++n;
+            curr_.append(b, n);
+            pos_ += n;
+            if (pos_ < end_) break;
         }
-        if (in_.peek() == '"') in_.get();
+        if (buf_[pos_] == '"') ++pos_;
         return;
     }
 
-    if (isdigit(static_cast<unsigned char>(c))) {
-        tok_ = T_INT_CONST;
-        while (in_ && isdigit(static_cast<unsigned char>(in_.peek()))) {
-            curr_.push_back(static_cast<char>(in_.get()));
-        }
-        return;
-    }
-
-    if(isalpha(static_cast<unsigned char>(c)) || c == '_'){
-        while (in_) {
-            int q = in_.peek();
-            if (q == EOF) break;
-            char d = static_cast<char>(q);
-            if (isalnum(static_cast<unsigned char>(d)) || d == '_') {
-                curr_.push_back(static_cast<char>(in_.get()));
-            } else {
-                break;
-            }
-        }
-        auto it = kwMap_.find(curr_);
-        if (it != kwMap_.end()) {
-            tok_ = T_KEYWORD;
-            kw_ = it->second;
-        } else {
-            tok_ = T_IDENTIFIER;
+    if (k & (C_DIGIT | C_IDSTART)) {
+        // digits run as an integer; a letter or '_' starts a word
+        uint8_t run = (k & C_DIGIT) ? C_DIGIT : C_IDCHAR;
+        size_t n = 1;
+        for (;;) {
+            while (pos_ + n < end_ && (kClass[static_cast<unsigned char>(buf_[pos_ + n])] & run)) ++n;
+            if (pos_ + n < end_ || !fill(n + 1)) break;
         }
+        curr_.assign(buf_.data() + pos_, n);
+        pos_ += n;
+        if (run == C_DIGIT) { tok_ = T_INT_CONST; return; }
+        tok_ = keywordOf(curr_, kw_) ? T_KEYWORD : T_IDENTIFIER;
         return;
     }
 
     tok_ = T_SYMBOL;
-    curr_.push_back(static_cast<char>(in_.get()));
+    curr_.push_back(c);
+    ++pos_;
 }
 
-void JackTokenizer::skipTrivia() {
+void JackTokenizer::skipLine() {
     for (;;) {
-        int p = in_.peek();
-        if (p == EOF) return;
-        char c = static_cast<char>(p);
+        const char* nl = static_cast<const char*>(memchr(buf_.data() + pos_, '\n', end_ - pos_));
+        if (nl) { pos_ = nl - buf_.data() + 1; return; }
+        pos_ = end_;
+        if (!fill(1)) return;
+    }
+}
 
-        if (isspace(static_cast<unsigned char>(c))) {
-            in_.get();
+void JackTokenizer::skipBlock() {
+    for (;;) {
+        const char* star = static_cast<const char*>(memchr(buf_.data() + pos_, '*', end_ - pos_));
+        if (!star) {
+            pos_ = end_;
+            if (!fill(1)) return;
             continue;
         }
+        pos_ = star - buf_.data();
+        if (!fill(2)) { pos_ = end_; return; }
+        if (buf_[pos_ + 1] == '/') { pos_ += 2; return; }
+        ++pos_;
+    }
+}
 
-        if (c == '/') {
-            in_.get();
-            int q = in_.peek();
-            if (q == EOF) { in_.unget(); return; }
-            char d = static_cast<char>(q);
-
-            if (d == '/') {
-                string dummy;
-                getline(in_, dummy);
-                continue;
-            }
-            if (d == '*') {
-                in_.get();
-                char prev = '\0', now = '\0';
-                bool closed = false;
-                while (in_.get(now)) {
-                    if (prev == '*' && now == '/') { closed = true; break; }
-                    prev = now;
-                }
-                (void)closed;
-                continue;
-            }
-
-            in_.unget();
-            return;
-        }
-
+void JackTokenizer::skipTrivia() {
+    for (;;) {
+        if (!fill(1)) return;
+        while (pos_ < end_ && (kClass[static_cast<unsigned char>(buf_[pos_])] & C_SPACE)) ++pos_;
+        if (pos_ == end_) continue;
+        if (buf_[pos_] != '/') return;
+        int d = peekAt(1);
+        if (d == '/') { pos_ += 2; skipLine(); continue; }
+        if (d == '*') { pos_ += 2; skipBlock(); continue; }
         return;
     }
 }
 
-static inline void writeSymbol(ostream& os, char s) {
-    if (s == '<')      os << "<symbol> &lt; </symbol>\n";
-    else if (s == '>') os << "<symbol> &gt; </symbol>\n";
-    else if (s == '&') os << "<symbol> &amp; </symbol>\n";
-    else               os << "<symbol> " << s << " </symbol>\n";
-}
+// Output is collected in one buffer and written in large chunks.
+class XmlWriter {
+public:
+    explicit XmlWriter(const fs::path& path) : out_(path, ios::binary) { buf_.reserve(kFlush + 256); }
+    ~XmlWriter() { flush(); }
+
+    void raw(const char* s, size_t n) {
+        buf_.append(s, n);
+        if (buf_.size() >= kFlush) flush();
+    }
+    void raw(const string& s) { raw(s.data(), s.size()); }
+    void element(const char* tag, size_t tagLen, const string& text) {
+        buf_ += '<'; buf_.append(tag, tagLen); buf_ += "> ";
+        buf_ += text;
+        buf_ += " </"; buf_.append(tag, tagLen); buf_ += ">\n";
+        if (buf_.size() >= kFlush) flush();
+    }
+    void symbol(char s) {
+        if (s == '<')      raw("<symbol> &lt; </symbol>\n", 24);
+        else if (s == '>') raw("<symbol> &gt; </symbol>\n", 24);
+        else if (s == '&') raw("<symbol> &amp; </symbol>\n", 25);
+        else { char line[] = "<symbol> ? </symbol>\n"; line[9] = s; raw(line, sizeof line - 1); }
+    }
+    void flush() {
+        Stats& stats = Stats::get();
+        auto timer = stats.time("write");
+        stats.add("bytes_out", static_cast<long long>(buf_.size()));
+        out_.write(buf_.data(), static_cast<streamsize>(buf_.size()));
+        buf_.clear();
+    }
+
+private:
+    static constexpr size_t kFlush = 1 << 16;
+    ofstream out_;
+    string buf_;
+};
 
 int main(int argc, char* argv[]) {
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " [fileName.jack | directoryName]\n";
+    Stats& stats = Stats::get();
+    fs::path input;
+    for (int i = 1; i < argc; ++i) {
+        if (!stats.parseFlag(argv[i], "tokenizer")) input = argv[i];
+    }
+    if (input.empty()) {
+        cerr << "Usage: " << argv[0] << " [--stats[=text|json][:file]] [fileName.jack | directoryName]\n";
         return 1;
     }
 
-    fs::path input(argv[1]);
     vector<fs::path> toProcess;
 
     if (fs::is_regular_file(input)) {
@@ -211,32 +287,37 @@ int main(int argc, char* argv[]) {
         }
 
         JackTokenizer tz(jackPath.string());
-        ofstream out(xmlOut);
-        out << "<tokens>\n";
+        XmlWriter out(xmlOut);
+        out.raw("<tokens>\n", 9);
 
+        auto timer = stats.time("tokenize");
+        long long tokens = 0;
         while (tz.hasMoreTokens()) {
             tz.advance();
+            ++tokens;
             switch (tz.tokenType()) {
                 case T_KEYWORD:
-                    out << "<keyword> " << tz.getCurrentToken() << " </keyword>\n";
+                    out.element("keyword", 7, tz.getCurrentToken());
                     break;
                 case T_SYMBOL:
-                    writeSymbol(out, tz.symbol());
+                    out.symbol(tz.symbol());
                     break;
                 case T_IDENTIFIER:
-                    out << "<identifier> " << tz.identifier() << " </identifier>\n";
+                    out.element("identifier", 10, tz.identifier());
                     break;
                 case T_INT_CONST:
-                    out << "<integerConstant> " << tz.intVal() << " </integerConstant>\n";
+                    out.element("integerConstant", 15, to_string(tz.intVal()));
                     break;
                 case T_STRING_CONST:
-                    out << "<stringConstant> " << tz.stringVal() << " </stringConstant>\n";
+                    out.element("stringConstant", 14, tz.stringVal());
                     break;
             }
         }
 
-        out << "</tokens>\n";
+        out.raw("</tokens>\n", 10);
+        stats.add("tokens", tokens);
     }
+    stats.add("files", static_cast<long long>(toProcess.size()));
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,12 @@
+// Runs Main.main and checks the results it stores in RAM[8000]-RAM[8002].
+
+load,
+output-file LetOrder.out,
+compare-to LetOrder.cmp,
+output-list RAM[8000]%D2.6.1 RAM[8001]%D2.6.1 RAM[8002]%D2.6.1;
+
+repeat 1000000 {
+  vmstep;
+}
+
+output;
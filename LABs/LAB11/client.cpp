@@ -0,0 +1,88 @@
+// Thin front end for the compiler server (server.cpp): sends its arguments,
+// with the source path made absolute, and writes the returned files where a
+// local compile would have put them (or prints them with --stdout).
+#include <bits/stdc++.h>
+#include <filesystem>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+using namespace std;
+namespace fs = std::filesystem;
+
+static string defaultSocket(){
+  if (const char* s = getenv("JACKD_SOCKET")) return s;
+  return "/tmp/jackd-"+to_string(getuid())+".sock";
+}
+
+int main(int argc, char** argv){
+  string sock = defaultSocket();
+  bool toStdout = false, timing = false;
+  vector<string> args;
+  for (int i=1; i<argc; ++i){
+    string a = argv[i];
+    if (a.rfind("--socket=",0)==0) sock = a.substr(9);
+    else if (a=="--stdout") toStdout = true;
+    else if (a=="--time") timing = true;
+    else if (!a.empty() && a[0]!='-') args.push_back(fs::absolute(a).string());
+    else if (!a.empty()) args.push_back(a);
+  }
+  if (args.empty()){
+    cerr<<"Usage: "<<argv[0]<<" [--socket=PATH] [--stdout] [--time] [--asm] [--string-pool] [--loop-opt]"
+          " [--lower[=speed|size]] <file.jack | directory>\n       "<<argv[0]<<" --shutdown\n";
+    return 1;
+  }
+
+  auto t0 = chrono::steady_clock::now();
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, sock.c_str(), sizeof addr.sun_path - 1);
+  if (fd<0 || connect(fd, (sockaddr*)&addr, sizeof addr)<0){
+    cerr<<"no compiler server on "<<sock<<" ("<<strerror(errno)<<")\n";
+    return 1;
+  }
+  string req;
+  for (auto& a: args){ req += a; req += '\0'; }
+  req += '\0';
+  for (size_t off=0; off<req.size(); ){
+    ssize_t n = write(fd, req.data()+off, req.size()-off);
+    if (n<=0){ cerr<<"request failed: "<<strerror(errno)<<'\n'; return 1; }
+    off += n;
+  }
+  string reply;
+  char chunk[1<<16];
+  for (ssize_t n; (n = read(fd, chunk, sizeof chunk)) > 0; ) reply.append(chunk, n);
+  close(fd);
+  auto t1 = chrono::steady_clock::now();
+
+  // records: "<tag> <length> <path>\n<body>", then "end <rc> <rebuilt> <classes> <us>"
+  int rc = 1;
+  bool writeFailed = false;
+  for (size_t i=0; i<reply.size(); ){
+    size_t nl = reply.find('\n', i);
+    if (nl==string::npos) break;
+    istringstream head(reply.substr(i, nl-i));
+    string tag; head>>tag;
+    if (tag=="end"){
+      long rebuilt = 0, classes = 0, us = 0;
+      head>>rc>>rebuilt>>classes>>us;
+      if (timing)
+        fprintf(stderr, "%ld of %ld classes rebuilt, server %.2f ms, round trip %.2f ms\n", rebuilt, classes,
+                us/1e3, chrono::duration<double, milli>(t1-t0).count());
+      break;
+    }
+    size_t len = 0; head>>len;
+    string path; getline(head>>ws, path);
+    string body = reply.substr(nl+1, len);
+    i = nl+1+len;
+    if (tag=="diag") cerr<<body<<'\n';
+    else if (tag=="rm"){ if (!toStdout){ error_code ec; fs::remove(path, ec); } }
+    else if (tag=="file"){
+      if (toStdout){ cout<<body; continue; }
+      ofstream o(path, ios::binary);
+      if (!o){ cerr<<"cannot open output: "<<path<<'\n'; writeFailed = true; continue; }
+      o<<body;
+    }
+  }
+  return writeFailed ? 1 : rc;
+}
@@ -1,5 +1,7 @@
 #include <bits/stdc++.h>
 #include <filesystem>
+#include <unistd.h>
+#include "../stats.h"
 using namespace std;
 namespace fs = std::filesystem;
 
@@ -9,74 +11,112 @@ enum class Kw {
   STATIC, FIELD, LET, DO, IF, ELSE, WHILE, RETURN, TRUE_, FALSE_, NULL_, THIS_
 };
 
+// Tokens are small and point back into the tokenizer's source buffer; every
+// distinct identifier is interned once and carries its id.
 struct Token {
-  TokType t{TokType::END};
-  Kw      kw{};
-  string  s;
-  int     ival{0};
-  char    ch{0};
+  TokType     t{TokType::END};
+  Kw          kw{};
+  char        ch{0};
+  union { int ival{0}; uint32_t id; };   // INTC value; ID: interned name
+  string_view s;                 // ID / STRC text
 };
 
+static string readFile(const string& path){
+  ifstream in(path, ios::binary);
+  if(!in) throw runtime_error("cannot open input: "+path);
+  return string((istreambuf_iterator<char>(in)), {});
+}
+
 class Tokenizer {
 public:
-  explicit Tokenizer(const string& path){ load(path); }
+  explicit Tokenizer(const string& path): src_(readFile(path)) { load(); }
+  Tokenizer(const string& /*path*/, string src): src_(std::move(src)) { load(); }
+  Tokenizer(const Tokenizer&) = delete;            // tokens view src_
+  Tokenizer& operator=(const Tokenizer&) = delete;
   bool hasMore() const { return pos_ < toks_.size(); }
   const Token& peek()  const { return toks_[pos_]; }
-  Token advance()      { return toks_[pos_++]; }
+  const Token& advance()     { return toks_[pos_++]; }
   bool isSym(char c) const { return hasMore() && toks_[pos_].t==TokType::SYM && toks_[pos_].ch==c; }
   void expectSym(char c, const char* ctx) { if (!isSym(c)) fail(string("expected '")+c+"' "+ctx); ++pos_; }
   void expectKw(Kw k, const char* ctx) { if (!hasMore() || toks_[pos_].t!=TokType::KW || toks_[pos_].kw!=k) fail(string("expected keyword in ")+ctx); ++pos_; }
-  string expectId(const char* ctx) { if (!hasMore() || toks_[pos_].t!=TokType::ID) fail(string("expected identifier: ")+ctx); return toks_[pos_++].s; }
+  string expectId(const char* ctx) { if (!hasMore() || toks_[pos_].t!=TokType::ID) fail(string("expected identifier: ")+ctx); return string(toks_[pos_++].s); }
+  size_t pos()  const { return pos_; }
+  void rewind() { pos_ = 0; }      // compile the same tokens again, e.g. under other options
+  size_t size() const { return toks_.size(); }
+  const Token& at(size_t i) const { return toks_[i]; }
+  size_t names() const { return names_.size(); }
 
 private:
+  string src_;                   // the arena every token and name views
   vector<Token> toks_;
   size_t pos_{0};
+  vector<string_view> names_;
+  unordered_map<string_view,uint32_t> ids_;
 
   [[noreturn]] static void fail(const string& m){ throw runtime_error(m); }
   static bool isIdStart(char c){ return isalpha((unsigned char)c) || c=='_'; }
   static bool isIdChar(char c){ return isalnum((unsigned char)c) || c=='_'; }
-  static optional<Kw> kwOf(const string& w){
-    static const unordered_map<string,Kw> M = {
-      {"class",Kw::CLASS},{"method",Kw::METHOD},{"function",Kw::FUNCTION},
-      {"constructor",Kw::CONSTRUCTOR},{"int",Kw::INT},{"boolean",Kw::BOOLEAN},
-      {"char",Kw::CHAR},{"void",Kw::VOID},{"var",Kw::VAR},{"static",Kw::STATIC},
-      {"field",Kw::FIELD},{"let",Kw::LET},{"do",Kw::DO},{"if",Kw::IF},
-      {"else",Kw::ELSE},{"while",Kw::WHILE},{"return",Kw::RETURN},
-      {"true",Kw::TRUE_},{"false",Kw::FALSE_},{"null",Kw::NULL_},{"this",Kw::THIS_}
-    };
-    auto it=M.find(w); if(it==M.end()) return nullopt; return it->second;
-  }
-  void emitSym(char c){ Token t; t.t=TokType::SYM; t.ch=c; toks_.push_back(t); }
-  void emitKw(Kw k){ Token t; t.t=TokType::KW; t.kw=k; toks_.push_back(t); }
-  void emitId(const string& s){ Token t; t.t=TokType::ID; t.s=s; toks_.push_back(t); }
-  void emitInt(int v){ Token t; t.t=TokType::INTC; t.ival=v; toks_.push_back(t); }
-  void emitStr(const string& s){ Token t; t.t=TokType::STRC; t.s=s; toks_.push_back(t); }
-  void load(const string& path){
-    ifstream in(path);
-    if(!in) fail("cannot open input: "+path);
-    string src((istreambuf_iterator<char>(in)), {});
+  static bool isSymChar(char c){
+    static const array<bool,128> T = []{
+      array<bool,128> t{};
+      for (char c: string_view("{}()[].,;+-*/&|<>=~")) t[(unsigned char)c] = true;
+      return t;
+    }();
+    return (unsigned char)c < 128 && T[(unsigned char)c];
+  }
+  // Dispatch on length and first letter; at most two comparisons per word.
+  static optional<Kw> kwOf(string_view w){
+    auto is = [&](const char* k, Kw v)->optional<Kw>{ if (w==k) return v; return nullopt; };
+    switch(w.size()){
+      case 2: switch(w[0]){ case 'd': return is("do", Kw::DO); case 'i': return is("if", Kw::IF); } break;
+      case 3: switch(w[0]){ case 'i': return is("int", Kw::INT); case 'v': return is("var", Kw::VAR); case 'l': return is("let", Kw::LET); } break;
+      case 4: switch(w[0]){
+        case 'c': return is("char", Kw::CHAR);  case 'v': return is("void", Kw::VOID);
+        case 'e': return is("else", Kw::ELSE);  case 'n': return is("null", Kw::NULL_);
+        case 't': if (w=="true") return Kw::TRUE_; return is("this", Kw::THIS_);
+      } break;
+      case 5: switch(w[0]){
+        case 'c': return is("class", Kw::CLASS); case 'f': if (w=="field") return Kw::FIELD; return is("false", Kw::FALSE_);
+        case 'w': return is("while", Kw::WHILE);
+      } break;
+      case 6: switch(w[0]){ case 'm': return is("method", Kw::METHOD); case 's': return is("static", Kw::STATIC); case 'r': return is("return", Kw::RETURN); } break;
+      case 7: return is("boolean", Kw::BOOLEAN);
+      case 8: return is("function", Kw::FUNCTION);
+      case 11: return is("constructor", Kw::CONSTRUCTOR);
+    }
+    return nullopt;
+  }
+  uint32_t intern(string_view w){
+    auto [it, fresh] = ids_.try_emplace(w, (uint32_t)names_.size());
+    if (fresh) names_.push_back(w);
+    return it->second;
+  }
+  void load(){
+    const string& src = src_;
     size_t i=0, n=src.size();
-    auto skipSpace=[&]{ while(i<n && isspace((unsigned char)src[i])) ++i; };
-    auto skipComment=[&]{
-      if (i+1<n && src[i]=='/' && src[i+1]=='/') { i+=2; while(i<n && src[i]!='\n') ++i; return true; }
-      if (i+1<n && src[i]=='/' && src[i+1]=='*') { i+=2; while(i+1<n && !(src[i]=='*' && src[i+1]=='/')) ++i; if(i+1<n) i+=2; return true; }
-      return false;
-    };
-    const string sym="{}()[].,;+-*/&|<>=~";
+    toks_.reserve(n/4);
+    auto push = [&](TokType t)->Token&{ toks_.emplace_back(); toks_.back().t=t; return toks_.back(); };
     while(i<n){
-      skipSpace();
-      if (skipComment()) continue;
-      if (i>=n) break;
       char c=src[i];
-      if (sym.find(c)!=string::npos){ emitSym(c); ++i; continue; }
-      if (c=='"'){ ++i; string s; while(i<n && src[i]!='"'){ s.push_back(src[i++]); } if(i<n) ++i; emitStr(s); continue; }
+      if (c==' ' || c=='\n' || c=='\t' || c=='\r' || c=='\f' || c=='\v'){ ++i; continue; }
+      if (c=='/' && i+1<n && src[i+1]=='/'){ i+=2; while(i<n && src[i]!='\n') ++i; continue; }
+      if (c=='/' && i+1<n && src[i+1]=='*'){ i+=2; while(i+1<n && !(src[i]=='*' && src[i+1]=='/')) ++i; if(i+1<n) i+=2; continue; }
+      if (isSymChar(c)){ push(TokType::SYM).ch=c; ++i; continue; }
+      if (c=='"'){
+        size_t b=++i; while(i<n && src[i]!='"') ++i;
+        push(TokType::STRC).s = string_view(src).substr(b, i-b);
+        if(i<n) ++i;
+        continue;
+      }
       if (isdigit((unsigned char)c)){
         int v=0; while(i<n && isdigit((unsigned char)src[i])) v=v*10+(src[i++]-'0');
-        emitInt(v); continue;
+        push(TokType::INTC).ival=v; continue;
       }
       if (isIdStart(c)){
-        string w; while(i<n && isIdChar(src[i])) w.push_back(src[i++]);
-        if (auto k=kwOf(w)) emitKw(*k); else emitId(w);
+        size_t b=i; while(i<n && isIdChar(src[i])) ++i;
+        string_view w = string_view(src).substr(b, i-b);
+        if (auto k=kwOf(w)) push(TokType::KW).kw=*k;
+        else { Token& t=push(TokType::ID); t.s=w; t.id=intern(w); }
         continue;
       }
       ++i;
@@ -85,88 +125,113 @@ private:
 };
 
 enum class Kind { STATIC, FIELD, ARG, VAR, NONE };
-struct Sym { string type; Kind k{Kind::NONE}; int idx{-1}; };
+// What a name resolves to; type is an interned id, see SymbolTable::typeName.
+struct Sym { Kind k{Kind::NONE}; int idx{-1}; uint32_t type{0}; };
 
+// Scopes are a stack over one flat vector of entries: the class scope sits at
+// the bottom and a subroutine (or a nested block, via pushScope) stacks on top,
+// so leaving a scope just truncates the vector. Names and types are interned
+// once per class; head_[id] is the innermost entry for a name and every entry
+// links to the one it shadows, so a lookup is one hash plus one index.
 class SymbolTable {
 public:
-  void startClass(){ c_.clear(); cStat_=cField_=0; }
-  void startSub(){ s_.clear(); sArg_=sVar_=0; }
-  void define(const string& name, const string& type, Kind k){
-    int idx = nextIndex(k);
-    Sym v{type,k,idx};
-    (isClassKind(k)? c_: s_)[name]=v;
-    bump(k);
+  void startClass(){ closeTo(0); scopes_.clear(); cnt_.fill(0); }
+  void startSub(){
+    closeTo(scopes_.empty()? syms_.size(): scopes_.front());
+    scopes_.assign(1, syms_.size());
+    cnt_[int(Kind::ARG)] = cnt_[int(Kind::VAR)] = 0;
   }
-  int varCount(Kind k) const { return count(k); }
-  Kind kindOf(const string& name) const {
-    if (auto it=s_.find(name); it!=s_.end()) return it->second.k;
-    if (auto it=c_.find(name); it!=c_.end()) return it->second.k;
-    return Kind::NONE;
-  }
-  string typeOf(const string& name) const {
-    if (auto it=s_.find(name); it!=s_.end()) return it->second.type;
-    if (auto it=c_.find(name); it!=c_.end()) return it->second.type;
-    return "";
+  // Block scopes keep numbering locals on from their parent, so a frame's
+  // local count stays the high-water mark.
+  void pushScope(){ scopes_.push_back(syms_.size()); }
+  void popScope(){ closeTo(scopes_.back()); scopes_.pop_back(); }
+  void define(const string& name, const string& type, Kind k){
+    uint32_t id = intern(name), tid = intern(type);
+    syms_.push_back({id, head_[id], Sym{k, cnt_[int(k)]++, tid}});
+    head_[id] = int(syms_.size())-1;
+    ++defined_;
   }
-  int indexOf(const string& name) const {
-    if (auto it=s_.find(name); it!=s_.end()) return it->second.idx;
-    if (auto it=c_.find(name); it!=c_.end()) return it->second.idx;
-    return -1;
+  int defined() const { return defined_; }
+  int varCount(Kind k) const { return k==Kind::NONE? 0: cnt_[int(k)]; }
+  const Sym* lookup(const string& name) const {
+    auto it = ids_.find(name);
+    if (it==ids_.end() || head_[it->second]<0) return nullptr;
+    return &syms_[head_[it->second]].sym;
   }
+  const string& typeName(uint32_t id) const { return names_[id]; }
 
 private:
-  unordered_map<string,Sym> c_, s_;
-  int cStat_{0}, cField_{0}, sArg_{0}, sVar_{0};
-  static bool isClassKind(Kind k){ return k==Kind::STATIC || k==Kind::FIELD; }
-  int nextIndex(Kind k) const {
-    switch(k){
-      case Kind::STATIC: return cStat_;
-      case Kind::FIELD:  return cField_;
-      case Kind::ARG:    return sArg_;
-      case Kind::VAR:    return sVar_;
-      default:           return 0;
-    }
-  }
-  void bump(Kind k){
-    switch(k){
-      case Kind::STATIC: ++cStat_; break;
-      case Kind::FIELD:  ++cField_; break;
-      case Kind::ARG:    ++sArg_;   break;
-      case Kind::VAR:    ++sVar_;   break;
-      default: break;
-    }
+  struct Entry { uint32_t name; int shadowed; Sym sym; };
+  vector<Entry> syms_;
+  vector<size_t> scopes_;
+  vector<int> head_;
+  vector<string> names_;
+  unordered_map<string,uint32_t> ids_;
+  array<int,4> cnt_{};
+  int defined_{0};
+  uint32_t intern(const string& s){
+    auto [it, fresh] = ids_.try_emplace(s, uint32_t(names_.size()));
+    if (fresh){ names_.push_back(s); head_.push_back(-1); }
+    return it->second;
   }
-  int count(Kind k) const {
-    switch(k){
-      case Kind::STATIC: return cStat_;
-      case Kind::FIELD:  return cField_;
-      case Kind::ARG:    return sArg_;
-      case Kind::VAR:    return sVar_;
-      default:           return 0;
-    }
+  void closeTo(size_t n){
+    while (syms_.size()>n){ head_[syms_.back().name] = syms_.back().shadowed; syms_.pop_back(); }
   }
 };
 
 enum class VMSeg { CONST, ARG, LOCAL, STATIC, THIS_, THAT, POINTER, TEMP };
 enum class VMOp  { ADD, SUB, NEG, EQ, GT, LT, AND, OR, NOT };
 
+// One VM command as emitted; text() renders the .vm form and the fused
+// pipeline hands the records straight to the VM translator.
+struct VMInstr {
+  enum Kind { PUSH, POP, OP, LABEL, GOTO, IFGOTO, CALL, FUNCTION, RETURN } k;
+  VMSeg  seg{};
+  VMOp   op{};
+  string name;                   // label, callee or function
+  int    n{0};                   // segment index, argument or local count
+};
+
 class VMWriter {
 public:
-  explicit VMWriter(const string& out){ out_.open(out); if(!out_) throw runtime_error("open vm failed"); }
-  void push(VMSeg s, int i){ ln("push "+seg(s)+" "+to_string(i)); }
-  void pop (VMSeg s, int i){ ln("pop "+seg(s)+" "+to_string(i)); }
-  void op  (VMOp  a)      { ln(opname(a)); }
-  void label(const string& L){ ln("label "+L); }
-  void go   (const string& L){ ln("goto "+L); }
-  void ifgo (const string& L){ ln("if-goto "+L); }
-  void call (const string& f, int n){ ln("call "+f+" "+to_string(n)); }
-  void func (const string& f, int nLoc){ ln("function "+f+" "+to_string(nLoc)); }
-  void ret  (){ ln("return"); }
-  void close(){ out_.close(); }
+  void push(VMSeg s, int i){ code_.push_back({VMInstr::PUSH, s, {}, {}, i}); }
+  void pop (VMSeg s, int i){ code_.push_back({VMInstr::POP, s, {}, {}, i}); }
+  void op  (VMOp  a)      { code_.push_back({VMInstr::OP, {}, a, {}, 0}); }
+  void label(const string& L){ code_.push_back({VMInstr::LABEL, {}, {}, L, 0}); }
+  void go   (const string& L){ code_.push_back({VMInstr::GOTO, {}, {}, L, 0}); }
+  void ifgo (const string& L){ code_.push_back({VMInstr::IFGOTO, {}, {}, L, 0}); }
+  void call (const string& f, int n){ code_.push_back({VMInstr::CALL, {}, {}, f, n}); }
+  void func (const string& f, int nLoc){ code_.push_back({VMInstr::FUNCTION, {}, {}, f, nLoc}); }
+  void ret  (){ code_.push_back({VMInstr::RETURN, {}, {}, {}, 0}); }
+  const vector<VMInstr>& code() const { return code_; }
+  string text() const {
+    string out;
+    for (auto& c: code_){
+      switch(c.k){
+        case VMInstr::PUSH:     out += "push "+seg(c.seg)+" "+to_string(c.n); break;
+        case VMInstr::POP:      out += "pop "+seg(c.seg)+" "+to_string(c.n); break;
+        case VMInstr::OP:       out += opname(c.op); break;
+        case VMInstr::LABEL:    out += "label "+c.name; break;
+        case VMInstr::GOTO:     out += "goto "+c.name; break;
+        case VMInstr::IFGOTO:   out += "if-goto "+c.name; break;
+        case VMInstr::CALL:     out += "call "+c.name+" "+to_string(c.n); break;
+        case VMInstr::FUNCTION: out += "function "+c.name+" "+to_string(c.n); break;
+        case VMInstr::RETURN:   out += "return"; break;
+      }
+      out += '\n';
+    }
+    return out;
+  }
+
+  // Code emitted between beginInsert(at) and endInsert() is spliced in at an earlier mark().
+  size_t mark() const { return code_.size(); }
+  void beginInsert(size_t at){ insAt_=at; swap(code_, ins_); }
+  void endInsert(){
+    swap(code_, ins_);
+    code_.insert(code_.begin()+insAt_, make_move_iterator(ins_.begin()), make_move_iterator(ins_.end()));
+    ins_.clear();
+  }
 
-private:
-  ofstream out_;
-  void ln(const string& s){ out_<<s<<'\n'; }
   static string seg(VMSeg s){
     switch(s){
       case VMSeg::CONST: return "constant"; case VMSeg::ARG: return "argument";
@@ -184,6 +249,10 @@ private:
       case VMOp::NOT: return "not";
     } return "add";
   }
+
+private:
+  vector<VMInstr> code_, ins_;
+  size_t insAt_{0};
 };
 
 static inline VMSeg kindToSeg(Kind k){
@@ -196,20 +265,407 @@ static inline VMSeg kindToSeg(Kind k){
   }
 }
 
+struct Options {
+  bool stringPool{false};   // string literals are built once into class statics
+  bool emitAsm{false};      // Hack assembly through AsmWriter instead of .vm text
+  bool loopOpt{false};      // rotate while loops and hoist their invariant expressions
+};
+
 struct LabelGen { int n=0; string get(const string& base){ return base+"_"+to_string(n++); } };
 
+// Expressions are parsed into a small tree before any code is emitted, so that
+// constant subexpressions and algebraic identities are simplified first.
+enum class EK { INT, STR, THIS_, VAR, INDEX, CALL, UNARY, BINARY };
+struct Expr {
+  EK     k;
+  int    v{0};                   // INT value, as a signed 16-bit word
+  char   op{0};                  // UNARY / BINARY operator
+  string s;                      // STR text, VAR / INDEX name, CALL callee
+  vector<unique_ptr<Expr>> a;    // operands, array index, call args (receiver first)
+  explicit Expr(EK kind): k(kind) {}
+};
+using ExprP = unique_ptr<Expr>;
+
+static ExprP mkInt(int v){ auto e=make_unique<Expr>(EK::INT); e->v=(int16_t)v; return e; }
+static bool isInt(const Expr& e, int v){ return e.k==EK::INT && e.v==v; }
+static bool isPure(const Expr& e){
+  if (e.k==EK::STR || e.k==EK::CALL) return false;
+  for (auto& x: e.a) if (!isPure(*x)) return false;
+  return true;
+}
+static int log2Exact(int v){
+  if (v<2 || (v&(v-1))) return -1;
+  int k=0; while((1<<k)<v) ++k; return k;
+}
+
+static ExprP mkUnary(char op, ExprP x){
+  if (x->k==EK::INT) return mkInt(op=='-' ? -x->v : ~x->v);
+  if (x->k==EK::UNARY && x->op==op) return std::move(x->a[0]);
+  auto e=make_unique<Expr>(EK::UNARY); e->op=op; e->a.push_back(std::move(x));
+  return e;
+}
+
+static ExprP mkBinary(char op, ExprP l, ExprP r){
+  if (l->k==EK::INT && r->k==EK::INT){
+    int x=l->v, y=r->v;
+    switch(op){
+      case '+': return mkInt(x+y);
+      case '-': return mkInt(x-y);
+      case '*': return mkInt(x*y);
+      case '/': if (y!=0 && !(x==-32768 && y==-1)) return mkInt(x/y); break;
+      case '&': return mkInt(x&y);
+      case '|': return mkInt(x|y);
+      case '<': return mkInt(x<y ? -1 : 0);
+      case '>': return mkInt(x>y ? -1 : 0);
+      case '=': return mkInt(x==y ? -1 : 0);
+    }
+  }
+  // constants are pure, so commutative operands can be reordered to put them on the right
+  if ((op=='+' || op=='*' || op=='&' || op=='|') && l->k==EK::INT) swap(l, r);
+  if (r->k==EK::INT){
+    int c=r->v;
+    if ((op=='+' || op=='-') && l->k==EK::BINARY && (l->op=='+' || l->op=='-') && l->a[1]->k==EK::INT){
+      int c1 = l->op=='+' ? l->a[1]->v : -l->a[1]->v;
+      return mkBinary('+', std::move(l->a[0]), mkInt(c1 + (op=='+' ? c : -c)));
+    }
+    switch(op){
+      case '+': if (c==0) return l; if (c<0 && c!=-32768) return mkBinary('-', std::move(l), mkInt(-c)); break;
+      case '-': if (c==0) return l; if (c<0 && c!=-32768) return mkBinary('+', std::move(l), mkInt(-c)); break;
+      case '*': if (c==0 && isPure(*l)) return mkInt(0); if (c==1) return l; if (c==-1) return mkUnary('-', std::move(l)); break;
+      case '/': if (c==1) return l; if (c==-1) return mkUnary('-', std::move(l)); break;
+      case '&': if (c==0 && isPure(*l)) return mkInt(0); if (c==-1) return l; break;
+      case '|': if (c==0) return l; if (c==-1 && isPure(*l)) return mkInt(-1); break;
+    }
+  }
+  if (op=='-' && isInt(*l, 0)) return mkUnary('-', std::move(r));
+  auto e=make_unique<Expr>(EK::BINARY); e->op=op;
+  e->a.push_back(std::move(l)); e->a.push_back(std::move(r));
+  return e;
+}
+
+// True when evaluating e may run another subroutine (which clobbers R5-R15).
+static bool hasCall(const Expr& e){
+  if (e.k==EK::STR || e.k==EK::CALL) return true;
+  if (e.k==EK::BINARY && e.op=='/') return true;
+  if (e.k==EK::BINARY && e.op=='*' && !(e.a[1]->k==EK::INT && log2Exact(abs(e.a[1]->v))>0)) return true;
+  for (auto& x: e.a) if (hasCall(*x)) return true;
+  return false;
+}
+static bool hasIndex(const Expr& e){
+  if (e.k==EK::INDEX) return true;
+  for (auto& x: e.a) if (hasIndex(*x)) return true;
+  return false;
+}
+// Values known to be 0 or -1, so bitwise & and | act as logical operators.
+static bool isBool(const Expr& e){
+  if (e.k==EK::INT) return e.v==0 || e.v==-1;
+  if (e.k==EK::UNARY) return e.op=='~' && isBool(*e.a[0]);
+  if (e.k!=EK::BINARY) return false;
+  if (e.op=='<' || e.op=='>' || e.op=='=') return true;
+  return (e.op=='&' || e.op=='|') && isBool(*e.a[0]) && isBool(*e.a[1]);
+}
+static bool sameExpr(const Expr& x, const Expr& y){
+  if (x.k!=y.k || x.v!=y.v || x.op!=y.op || x.s!=y.s || x.a.size()!=y.a.size()) return false;
+  for (size_t i=0; i<x.a.size(); ++i) if (!sameExpr(*x.a[i], *y.a[i])) return false;
+  return true;
+}
+// Operators and array reads in e: a rough count of the VM commands it costs beyond its leaves.
+static int opCount(const Expr& e){
+  int n = (e.k==EK::UNARY || e.k==EK::BINARY || e.k==EK::INDEX);
+  for (auto& x: e.a) n += opCount(*x);
+  return n;
+}
+
+// Hack assembly straight from the expression trees. Values are computed in D,
+// spilled to R5-R12 while no call can intervene and to the stack otherwise;
+// R13 is a short-lived scratch and R14 holds an array-store address. Calls,
+// frames and returns follow the VM convention, so the output links with
+// translated .vm modules.
+class AsmWriter {
+public:
+  explicit AsmWriter(const SymbolTable& st): st_(st) {}
+  function<int(const string&)> strSlot;   // set when string literals live in pooled statics
+  void setClass(const string& c){ cls_=c; }
+  const string& text() const { return buf_; }
+  size_t mark() const { return buf_.size(); }
+  void beginInsert(size_t at){ insAt_=at; swap(buf_, ins_); }
+  void endInsert(){ swap(buf_, ins_); buf_.insert(insAt_, ins_); ins_.clear(); }
+
+  // Names labels after the function; its header is emitted later by func().
+  void begin(const string& name){ fn_=name; ret_=0; }
+  void func(const string& name, int nLocals){
+    ln("("+name+")");
+    if (nLocals==1) ln("@SP\nA=M\nM=0\n@SP\nM=M+1");
+    else if (nLocals>1){
+      ln("@SP\nA=M\nM=0");
+      for (int i=1; i<nLocals; ++i) ln("A=A+1\nM=0");
+      ln("D=A+1\n@SP\nM=D");
+    }
+  }
+  void thisFromArg0(){ ln("@ARG\nA=M\nD=M\n@THIS\nM=D"); }
+  void thisFromAlloc(int nFields){
+    pushConst(nFields); call("Memory.alloc", 1); popD();
+    ln("@THIS\nM=D");
+  }
+  void label(const string& L){ ln("("+fn_+"$"+L+")"); }
+  void go(const string& L){ ln("@"+fn_+"$"+L+"\n0;JMP"); }
+
+  void let(const string& name, const Expr* index, const Expr& value){
+    if (!index){
+      if (isTiny(value) && addrA(name, 7)){ ln("M="+to_string(value.v)); return; }
+      genD(value);
+      if (addrA(name, 7)){ ln("M=D"); return; }
+      ln("@R13\nM=D"); addrAny(name); ln("D=A\n@R14\nM=D\n@R13\nD=M\n@R14\nA=M\nM=D");
+      return;
+    }
+    elemAddrD(name, *index);
+    if (isTiny(value)){ ln("A=D\nM="+to_string(value.v)); return; }
+    if (!hasCall(value)){ ln("@R14\nM=D"); genD(value); ln("@R14\nA=M\nM=D"); return; }
+    pushD(); genD(value); ln("@SP\nAM=M-1\nA=M\nM=D");
+  }
+  void doCall(const Expr& e){ callArgs(e); ln("@SP\nM=M-1"); }
+  void ret(const Expr* value){
+    if (value) genD(*value); else ln("D=0");
+    ln("@R13\nM=D");
+    ln("@LCL\nD=M\n@5\nA=D-A\nD=M\n@R14\nM=D");
+    ln("@R13\nD=M\n@ARG\nA=M\nM=D");
+    ln("@ARG\nD=M+1\n@SP\nM=D");
+    for (const char* r: {"THAT", "THIS", "ARG", "LCL"}) ln(string("@LCL\nAM=M-1\nD=M\n@")+r+"\nM=D");
+    ln("@R14\nA=M\n0;JMP");
+  }
+  // Jumps to L when the condition is false, i.e. exactly when the VM sequence
+  // "cond; not; if-goto L" would, and jumpIfTrue is the complement.
+  void jumpIfFalse(const Expr& e, const string& L){ branch(e, fn_+"$"+L, false); }
+  void jumpIfTrue(const Expr& e, const string& L){ branch(e, fn_+"$"+L, true); }
+
+  void poolGuard(int slot, const string& Lready, const string& initFn){
+    ln("@"+cls_+"."+to_string(slot)+"\nD=M\n@"+fn_+"$"+Lready+"\nD;JNE");
+    call(initFn, 0); ln("@SP\nM=M-1");
+    label(Lready);
+  }
+  void storeNewString(const string& s, int slot){
+    newString(s); popD();
+    ln("@"+cls_+"."+to_string(slot)+"\nM=D");
+  }
+
+private:
+  const SymbolTable& st_;
+  string cls_, fn_, buf_, ins_;
+  size_t insAt_{0};
+  int    ret_{0}, tmp_{0}, depth_{0};
+
+  void ln(const string& s){ buf_+=s; buf_+='\n'; }
+  string newLabel(){ return fn_+"$T."+to_string(tmp_++); }
+  void pushD(){ ln("@SP\nAM=M+1\nA=A-1\nM=D"); }
+  void popD(){ ln("@SP\nAM=M-1\nD=M"); }
+  void pushConst(int v){ loadConstD(v); pushD(); }
+  static bool isTiny(const Expr& e){ return e.k==EK::INT && (e.v==0 || e.v==1 || e.v==-1); }
+
+  void loadConstD(int v){
+    if (v==0 || v==1 || v==-1){ ln("D="+to_string(v)); return; }
+    if (v>0) ln("@"+to_string(v)+"\nD=A");
+    else if (v>-32768) ln("@"+to_string(-v)+"\nD=-A");
+    else ln("@32767\nD=!A");
+  }
+  void loadConstA(int v){ if (v>=0) ln("@"+to_string(v)); else ln("@"+to_string(~v)+"\nA=!A"); }
+
+  static const char* frameBase(Kind k){
+    switch(k){
+      case Kind::VAR: return "LCL"; case Kind::ARG: return "ARG"; case Kind::FIELD: return "THIS";
+      default: return nullptr;
+    }
+  }
+  const Sym& var(const string& name) const {
+    const Sym* v = st_.lookup(name);
+    if (!v) throw runtime_error("undefined variable: "+name);
+    return *v;
+  }
+  // A := address of the variable without touching D, when the offset is within
+  // an A=A+1 chain of maxChain; otherwise emits nothing and returns false.
+  bool addrA(const string& name, int maxChain){
+    const Sym& v = var(name); Kind k = v.k; int i = v.idx;
+    if (k==Kind::STATIC){ ln("@"+cls_+"."+to_string(i)); return true; }
+    if (i>maxChain) return false;
+    ln(string("@")+frameBase(k)+"\nA=M");
+    for (; i>0; --i) ln("A=A+1");
+    return true;
+  }
+  // A := address of the variable; may clobber D.
+  void addrAny(const string& name){
+    if (addrA(name, 2)) return;
+    const Sym& v = var(name);
+    ln("@"+to_string(v.idx)+"\nD=A\n@"+frameBase(v.k)+"\nA=D+M");
+  }
+  bool cheapVar(const string& name) const {
+    const Sym* v = st_.lookup(name);
+    return v && (v->k==Kind::STATIC || v->idx<=3);
+  }
+  // Operands that can be read through A alone, leaving D intact.
+  bool isOperand(const Expr& e) const {
+    return e.k==EK::INT || e.k==EK::THIS_ || (e.k==EK::VAR && cheapVar(e.s));
+  }
+  // Values no subroutine call can change: constants, THIS and the frame's own slots.
+  bool isStable(const Expr& e) const {
+    if (e.k==EK::INT || e.k==EK::THIS_) return true;
+    if (e.k!=EK::VAR) return false;
+    const Sym* v = st_.lookup(e.s);
+    return v && (v->k==Kind::VAR || v->k==Kind::ARG);
+  }
+  // Sets A so the operand is in M, or in A itself for constants (returns true).
+  bool operandA(const Expr& e){
+    if (e.k==EK::INT){ loadConstA(e.v); return true; }
+    if (e.k==EK::THIS_) ln("@THIS");
+    else addrA(e.s, 3);
+    return false;
+  }
+  static string combine(char op, bool imm, bool swapped){
+    string src = imm ? "A" : "M";
+    switch(op){
+      case '+': return "D=D+"+src;
+      case '&': return "D=D&"+src;
+      case '|': return "D=D|"+src;
+      default:  return swapped ? "D="+src+"-D" : "D=D-"+src;
+    }
+  }
+
+  // D := l op r for + - & |; the comparisons use '-' and test the sign of D.
+  void binaryD(char op, const Expr& l, const Expr& r){
+    if (op=='-' && isInt(r, 0)){ genD(l); return; }
+    if (isOperand(r)){ genD(l); bool imm=operandA(r); ln(combine(op, imm, false)); return; }
+    if (isOperand(l) && (!hasCall(r) || isStable(l))){ genD(r); bool imm=operandA(l); ln(combine(op, imm, true)); return; }
+    if (!hasCall(r) && depth_<8){
+      string t = "@R"+to_string(5+depth_);
+      genD(l); ln(t+"\nM=D");
+      ++depth_; genD(r); --depth_;
+      ln(t); ln(combine(op, false, true));
+      return;
+    }
+    genD(l); pushD(); genD(r);
+    ln("@SP\nAM=M-1"); ln(combine(op, false, true));
+  }
+  // D := address of name[index]
+  void elemAddrD(const string& name, const Expr& index){
+    genD(index);
+    if (cheapVar(name)){ addrA(name, 3); ln("D=D+M"); return; }
+    ln("@R13\nM=D"); addrAny(name); ln("D=M\n@R13\nD=D+M");
+  }
+  void genD(const Expr& e){
+    switch(e.k){
+      case EK::INT: loadConstD(e.v); return;
+      case EK::STR:
+        if (strSlot){ ln("@"+cls_+"."+to_string(strSlot(e.s))+"\nD=M"); return; }
+        newString(e.s); popD();
+        return;
+      case EK::THIS_: ln("@THIS\nD=M"); return;
+      case EK::VAR: addrAny(e.s); ln("D=M"); return;
+      case EK::INDEX: {
+        const Expr& ix = *e.a[0];
+        if (ix.k==EK::INT && ix.v>=0 && ix.v<=3){
+          addrAny(e.s); ln("A=M");
+          for (int i=0; i<ix.v; ++i) ln("A=A+1");
+          ln("D=M");
+          return;
+        }
+        elemAddrD(e.s, ix); ln("A=D\nD=M");
+        return;
+      }
+      case EK::CALL: callArgs(e); popD(); return;
+      case EK::UNARY: genD(*e.a[0]); ln(e.op=='-' ? "D=-D" : "D=!D"); return;
+      case EK::BINARY: break;
+    }
+    switch(e.op){
+      case '*': {
+        int c = e.a[1]->k==EK::INT ? e.a[1]->v : 0, k = log2Exact(abs(c));
+        if (k>0){
+          genD(*e.a[0]); ln("@R13\nM=D");
+          for (int i=0; i<k; ++i){ ln("D=D+M"); if (i+1<k) ln("M=D"); }
+          if (c<0) ln("D=-D");
+          return;
+        }
+        callD("Math.multiply", *e.a[0], *e.a[1]);
+        return;
+      }
+      case '/': callD("Math.divide", *e.a[0], *e.a[1]); return;
+      case '<': case '>': case '=': {
+        string Lt = newLabel(), Le = newLabel();
+        binaryD('-', *e.a[0], *e.a[1]);
+        ln("@"+Lt+"\nD;"+jump(e.op, true)+"\nD=0\n@"+Le+"\n0;JMP\n("+Lt+")\nD=-1\n("+Le+")");
+        return;
+      }
+      default: binaryD(e.op, *e.a[0], *e.a[1]); return;
+    }
+  }
+  static string jump(char op, bool onTrue){
+    switch(op){
+      case '<': return onTrue ? "JLT" : "JGE";
+      case '>': return onTrue ? "JGT" : "JLE";
+      default:  return onTrue ? "JEQ" : "JNE";
+    }
+  }
+  void branch(const Expr& e, const string& L, bool onTrue){
+    if (e.k==EK::INT){ if ((e.v==-1)==onTrue) ln("@"+L+"\n0;JMP"); return; }
+    if (e.k==EK::UNARY && e.op=='~'){
+      const Expr& x = *e.a[0];
+      if (isBool(x)){ branch(x, L, !onTrue); return; }
+      genD(x); ln("@"+L+"\nD;"+(onTrue ? "JEQ" : "JNE"));
+      return;
+    }
+    if (e.k==EK::BINARY && (e.op=='<' || e.op=='>' || e.op=='=')){
+      binaryD('-', *e.a[0], *e.a[1]);
+      ln("@"+L+"\nD;"+jump(e.op, onTrue));
+      return;
+    }
+    // both sides are 0/-1 and the right one has no effects, so it may be skipped
+    if (e.k==EK::BINARY && (e.op=='&' || e.op=='|') && isBool(e) && !hasCall(*e.a[1])){
+      bool shortOn = e.op=='|';      // the value of the left side that decides the result
+      if (onTrue==shortOn){ branch(*e.a[0], L, onTrue); branch(*e.a[1], L, onTrue); return; }
+      string Lskip = newLabel();
+      branch(*e.a[0], Lskip, shortOn);
+      branch(*e.a[1], L, onTrue);
+      ln("("+Lskip+")");
+      return;
+    }
+    genD(e); ln("D=D+1\n@"+L+"\nD;"+(onTrue ? "JEQ" : "JNE"));
+  }
+
+  void callD(const string& f, const Expr& a, const Expr& b){
+    genD(a); pushD(); genD(b); pushD();
+    call(f, 2); popD();
+  }
+  void callArgs(const Expr& e){
+    for (auto& x: e.a){ genD(*x); pushD(); }
+    call(e.s, (int)e.a.size());
+  }
+  void newString(const string& s){
+    pushConst((int)s.size()); call("String.new", 1);
+    for (unsigned char c: s){ pushConst(c); call("String.appendChar", 2); }
+  }
+  // Pushes the return address and the caller's frame, then repoints ARG and LCL.
+  void call(const string& f, int nArgs){
+    string ret = fn_+"$RET."+to_string(ret_++);
+    ln("@"+ret+"\nD=A\n@SP\nA=M\nM=D");
+    for (const char* r: {"LCL", "ARG", "THIS", "THAT"}) ln(string("@")+r+"\nD=M\n@SP\nAM=M+1\nM=D");
+    ln("@SP\nMD=M+1\n@LCL\nM=D\n@"+to_string(nArgs+5)+"\nD=D-A\n@ARG\nM=D");
+    ln("@"+f+"\n0;JMP\n("+ret+")");
+  }
+};
+
 class Engine {
 public:
-  Engine(Tokenizer& tz, VMWriter& vm, SymbolTable& st)
-  : tz_(tz), vm_(vm), st_(st) {}
+  Engine(Tokenizer& tz, VMWriter& vm, SymbolTable& st, const Options& opt = {}, AsmWriter* as = nullptr)
+  : tz_(tz), vm_(vm), st_(st), opt_(opt), as_(as) {
+    if (as_ && opt_.stringPool) as_->strSlot = [this](const string& s){ return poolSlot(intern(s)); };
+  }
   void compileClass(){
     st_.startClass();
     tz_.expectKw(Kw::CLASS, "class");
     className_ = tz_.expectId("class name");
+    if (as_) as_->setClass(className_);
     tz_.expectSym('{', "after class name");
     while (isKw({Kw::STATIC, Kw::FIELD})) compileClassVarDec();
     while (isKw({Kw::CONSTRUCTOR, Kw::FUNCTION, Kw::METHOD})) compileSubroutine();
     tz_.expectSym('}', "end of class");
+    if (!pool_.empty()) compileStringPoolInit();
   }
 
 private:
@@ -218,6 +674,69 @@ private:
   SymbolTable& st_;
   LabelGen   L_;
   string     className_;
+  Options    opt_;
+  AsmWriter* as_;              // set when assembly is emitted directly
+  // What pointer 1 holds within the current basic block: base + index variable
+  // (empty for constant indices), so element k of it is just "that k".
+  struct ThatKey { string base, index; };
+  optional<ThatKey> that_;
+  // Enclosing while loops (--loop-opt): what their bodies may change, where the
+  // preheader goes, and the invariant expressions moved there.
+  struct Loop {
+    set<string> assigned;
+    bool calls{false}, stores{false};
+    size_t preheader{0};
+    vector<pair<string, ExprP>> hoisted;
+  };
+  vector<Loop> loops_;
+  int nHoisted_{0};
+  // string pool: literal -> slot, slots live in statics after the declared ones
+  unordered_map<string,int> pool_;
+  vector<string> poolOrder_;
+  bool       subUsesPool_{false};
+
+  int poolSlot(int k) const { return st_.varCount(Kind::STATIC) + k; }
+  string poolInitName() const { return className_+".$initStrings"; }
+  int intern(const string& s){
+    auto [it, added] = pool_.try_emplace(s, (int)poolOrder_.size());
+    if (added) poolOrder_.push_back(s);
+    subUsesPool_ = true;
+    return it->second;
+  }
+  // Every subroutine that reads the pool first makes sure it has been built.
+  void emitPoolGuard(){
+    string Lready = L_.get("STRINGS_READY");
+    if (as_){ as_->poolGuard(poolSlot(0), Lready, poolInitName()); return; }
+    vm_.push(VMSeg::STATIC, poolSlot(0));
+    vm_.ifgo(Lready);
+    emitCall(poolInitName(), 0);
+    vm_.pop(VMSeg::TEMP, 0);
+    vm_.label(Lready);
+  }
+  void compileStringPoolInit(){
+    if (as_){
+      as_->begin(poolInitName());
+      as_->func(poolInitName(), 0);
+      for (size_t k=0; k<poolOrder_.size(); ++k) as_->storeNewString(poolOrder_[k], poolSlot((int)k));
+      as_->ret(nullptr);
+      return;
+    }
+    vm_.func(poolInitName(), 0);
+    for (size_t k=0; k<poolOrder_.size(); ++k){
+      emitNewString(poolOrder_[k]);
+      vm_.pop(VMSeg::STATIC, poolSlot((int)k));
+    }
+    vm_.push(VMSeg::CONST, 0);
+    vm_.ret();
+  }
+  void emitNewString(const string& s){
+    vm_.push(VMSeg::CONST, (int)s.size());
+    emitCall("String.new", 1);
+    for (unsigned char c: s){
+      vm_.push(VMSeg::CONST, (int)c);
+      emitCall("String.appendChar", 2);
+    }
+  }
 
   bool isKw(std::initializer_list<Kw> set){
     if(!tz_.hasMore()) return false;
@@ -253,25 +772,40 @@ private:
     string rtype = readType(); (void)rtype;
     string name  = tz_.expectId("subroutine name");
     st_.startSub();
+    that_.reset();
     if (stype==Kw::METHOD) st_.define("this", className_, Kind::ARG);
     tz_.expectSym('(', "param '('");
     compileParameterList();
     tz_.expectSym(')', "param ')'");
     tz_.expectSym('{', "subroutine '{'");
     while (isKw({Kw::VAR})) compileVarDec();
-    int nLocals = st_.varCount(Kind::VAR);
-    vm_.func(className_+"."+name, nLocals);
+    string fname = className_+"."+name;
+    subUsesPool_ = false;
+    if (as_) as_->begin(fname);
+    // the header is inserted here at the end, once hoisted loop invariants have added their locals
+    size_t entry = mark();
     if (stype==Kw::CONSTRUCTOR){
       int nFields = st_.varCount(Kind::FIELD);
-      vm_.push(VMSeg::CONST, nFields);
-      vm_.call("Memory.alloc", 1);
-      vm_.pop(VMSeg::POINTER, 0);
+      if (as_) as_->thisFromAlloc(nFields);
+      else {
+        vm_.push(VMSeg::CONST, nFields);
+        vm_.call("Memory.alloc", 1);
+        vm_.pop(VMSeg::POINTER, 0);
+      }
     } else if (stype==Kw::METHOD){
-      vm_.push(VMSeg::ARG, 0);
-      vm_.pop(VMSeg::POINTER, 0);
+      if (as_) as_->thisFromArg0();
+      else {
+        vm_.push(VMSeg::ARG, 0);
+        vm_.pop(VMSeg::POINTER, 0);
+      }
     }
     compileStatements();
     tz_.expectSym('}', "subroutine '}'");
+    if (subUsesPool_) insertAt(entry, [&]{ emitPoolGuard(); });
+    insertAt(entry, [&]{
+      if (as_) as_->func(fname, st_.varCount(Kind::VAR));
+      else vm_.func(fname, st_.varCount(Kind::VAR));
+    });
   }
   void compileParameterList(){
     if (tz_.isSym(')')) return;
@@ -308,207 +842,514 @@ private:
   void compileLet(){
     tz_.advance();
     string name = tz_.expectId("let var");
-    Kind  k = st_.kindOf(name); VMSeg sg = kindToSeg(k); int ix = st_.indexOf(name);
-    bool isArray=false;
+    Sym v = varOf(name); Kind k = v.k; VMSeg sg = kindToSeg(k); int ix = v.idx;
+    ExprP index;
     if (tz_.isSym('[')){
       tz_.advance();
-      compileExpression();
+      index = parseExpression();
       tz_.expectSym(']', "']'");
-      vm_.push(sg, ix);
-      vm_.op(VMOp::ADD);
-      isArray=true;
     }
     tz_.expectSym('=', "'='");
-    compileExpression();
+    ExprP value = parseExpression();
     tz_.expectSym(';', "';'");
-    if (isArray){
-      vm_.pop(VMSeg::TEMP, 0);
-      vm_.pop(VMSeg::POINTER, 1);
-      vm_.push(VMSeg::TEMP, 0);
-      vm_.pop(VMSeg::THAT, 0);
-    } else {
+    if (index) index = hoist(std::move(index));
+    value = hoist(std::move(value));
+    if (as_){ as_->let(name, index.get(), *value); return; }
+    if (!index){
+      emitExpr(*value);
       vm_.pop(sg, ix);
+      if (that_ && (that_->base==name || that_->index==name)) that_.reset();
+      return;
+    }
+    // calls return with THAT restored, so only array reads on the right disturb pointer 1
+    if (!hasIndex(*value)){
+      int off = pointThat(name, *index);
+      emitExpr(*value);
+      vm_.pop(VMSeg::THAT, off);
+      return;
     }
+    // without calls the order of evaluation cannot be observed
+    if (!hasCall(*index) && !hasCall(*value)){
+      emitExpr(*value);
+      vm_.pop(VMSeg::THAT, pointThat(name, *index));
+      return;
+    }
+    emitExpr(*index);
+    vm_.push(sg, ix);
+    vm_.op(VMOp::ADD);
+    emitExpr(*value);
+    vm_.pop(VMSeg::TEMP, 0);
+    vm_.pop(VMSeg::POINTER, 1);
+    vm_.push(VMSeg::TEMP, 0);
+    vm_.pop(VMSeg::THAT, 0);
+    that_.reset();
   }
   void compileIf(){
     tz_.advance();
     string Lfalse = L_.get("IF_FALSE");
     string Lend  = L_.get("IF_END");
     tz_.expectSym('(', "(");
-    compileExpression();
+    ExprP cond = parseExpression();
     tz_.expectSym(')', ")");
-    vm_.op(VMOp::NOT);
-    vm_.ifgo(Lfalse);
+    hoistOperands(*cond);
+    emitJumpIfFalse(*cond, Lfalse);
     tz_.expectSym('{', "{");
     compileStatements();
     tz_.expectSym('}', "}");
     if (tz_.hasMore() && tz_.peek().t==TokType::KW && tz_.peek().kw==Kw::ELSE){
-      vm_.go(Lend);
-      vm_.label(Lfalse);
+      go(Lend);
+      label(Lfalse);
       tz_.advance();
       tz_.expectSym('{', "{");
       compileStatements();
       tz_.expectSym('}', "}");
-      vm_.label(Lend);
+      label(Lend);
     } else {
-      vm_.label(Lfalse);
+      label(Lfalse);
     }
   }
   void compileWhile(){
     tz_.advance();
     string Ltop = L_.get("WHILE_EXP");
     string Lend = L_.get("WHILE_END");
-    vm_.label(Ltop);
     tz_.expectSym('(', "(");
-    compileExpression();
+    ExprP cond = parseExpression();
     tz_.expectSym(')', ")");
-    vm_.op(VMOp::NOT);
-    vm_.ifgo(Lend);
     tz_.expectSym('{', "{");
+    if (!opt_.loopOpt){
+      label(Ltop);
+      emitJumpIfFalse(*cond, Lend);
+      compileStatements();
+      tz_.expectSym('}', "}");
+      go(Ltop);
+      label(Lend);
+      return;
+    }
+    // Rotated: the test sits at the bottom and jumps back while true, which
+    // needs no "not" when the condition is already 0/-1.
+    bool rotate = as_ || isBool(*cond);
+    loops_.push_back(scanBody(*cond));
+    loops_.back().preheader = mark();
+    hoistOperands(*cond);
+    string Ltest = L_.get("WHILE_TEST");
+    if (rotate){ go(Ltest); label(Ltop); }
+    else { label(Ltop); emitJumpIfFalse(*cond, Lend); }
     compileStatements();
     tz_.expectSym('}', "}");
-    vm_.go(Ltop);
-    vm_.label(Lend);
+    if (rotate){ label(Ltest); emitJumpIfTrue(*cond, Ltop); }
+    else { go(Ltop); label(Lend); }
+    Loop lp = std::move(loops_.back());
+    loops_.pop_back();
+    if (lp.hoisted.empty()) return;
+    auto saved = that_;
+    that_.reset();
+    insertAt(lp.preheader, [&]{
+      for (auto& [name, e]: lp.hoisted){
+        if (as_) as_->let(name, nullptr, *e);
+        else { emitExpr(*e); pushVarTo(name); }
+      }
+    });
+    that_ = saved;
+  }
+  // Reads ahead over the loop body's tokens for the variables it assigns and
+  // whether it may call out (which can change fields, statics and memory) or
+  // store into arrays.
+  Loop scanBody(const Expr& cond){
+    Loop lp;
+    lp.calls = hasCall(cond);
+    int depth = 1;
+    for (size_t i=tz_.pos(); i<tz_.size() && depth>0; ++i){
+      const Token& t = tz_.at(i);
+      if (t.t==TokType::SYM){
+        if (t.ch=='{') ++depth;
+        else if (t.ch=='}') --depth;
+        else if (t.ch=='(' && tz_.at(i-1).t==TokType::ID) lp.calls = true;
+        else if (t.ch=='*' || t.ch=='/') lp.calls = true;
+      }
+      else if (t.t==TokType::STRC) lp.calls = true;
+      else if (t.t==TokType::KW && t.kw==Kw::DO) lp.calls = true;
+      else if (t.t==TokType::KW && t.kw==Kw::LET && i+2<tz_.size()){
+        if (tz_.at(i+2).t==TokType::SYM && tz_.at(i+2).ch=='[') lp.stores = true;
+        else lp.assigned.insert(string(tz_.at(i+1).s));
+      }
+    }
+    return lp;
   }
+  bool invariant(const Expr& e, const Loop& lp) const {
+    switch(e.k){
+      case EK::INT: case EK::THIS_: return true;
+      case EK::STR: case EK::CALL:  return false;
+      case EK::VAR:   return !lp.assigned.count(e.s) && (inFrame(e.s) || (!lp.calls && !lp.stores));
+      case EK::INDEX: return !lp.stores && !lp.calls && !lp.assigned.count(e.s) && invariant(*e.a[0], lp);
+      default: break;
+    }
+    if (hasCall(e)) return false;
+    for (auto& x: e.a) if (!invariant(*x, lp)) return false;
+    return true;
+  }
+  // Replaces the largest loop-invariant subexpressions with fresh locals that
+  // the innermost loop's preheader computes once. A lone operator on leaves
+  // (say arg+2) only breaks even after a few iterations, so it is left in place
+  // unless the same expression was already hoisted.
+  ExprP hoist(ExprP e){
+    if (loops_.empty()) return e;
+    Loop& lp = loops_.back();
+    bool leaf = e->k==EK::INT || e->k==EK::VAR || e->k==EK::THIS_;
+    if (!leaf && invariant(*e, lp)){
+      string name;
+      for (auto& [n, h]: lp.hoisted) if (sameExpr(*h, *e)){ name = n; break; }
+      if (name.empty() && (e->k==EK::INDEX || opCount(*e)>1)){
+        name = "$inv"+to_string(nHoisted_++);
+        st_.define(name, "int", Kind::VAR);
+        lp.hoisted.emplace_back(name, std::move(e));
+      }
+      if (!name.empty()){ auto v=make_unique<Expr>(EK::VAR); v->s=name; return v; }
+    }
+    for (auto& x: e->a) x = hoist(std::move(x));
+    return e;
+  }
+  // Conditions keep their top-level shape so jumps can still test comparisons directly.
+  void hoistOperands(Expr& e){ for (auto& x: e.a) x = hoist(std::move(x)); }
   void compileDo(){
     tz_.advance();
-    compileSubroutineCall();
+    ExprP call = parseCall(tz_.expectId("call first"));
     tz_.expectSym(';', "';'");
+    hoistOperands(*call);
+    if (as_){ as_->doCall(*call); return; }
+    emitExpr(*call);
     vm_.pop(VMSeg::TEMP, 0);
   }
   void compileReturn(){
     tz_.advance();
-    if (!tz_.isSym(';')) {
-      compileExpression();
-    } else {
-      vm_.push(VMSeg::CONST, 0);
-    }
+    ExprP value;
+    if (!tz_.isSym(';')) value = hoist(parseExpression());
     tz_.expectSym(';', "';'");
+    if (as_){ as_->ret(value.get()); return; }
+    if (value) emitExpr(*value);
+    else vm_.push(VMSeg::CONST, 0);
     vm_.ret();
   }
-  void compileExpression(){
-    compileTerm();
+  void compileExpression(){ emitExpr(*parseExpression()); }
+
+  ExprP parseExpression(){
+    ExprP e = parseTerm();
     while (tz_.hasMore() && tz_.peek().t==TokType::SYM){
       char op = tz_.peek().ch;
       if (string("+-*/&|<=>").find(op)==string::npos) break;
       tz_.advance();
-      compileTerm();
-      switch(op){
-        case '+': vm_.op(VMOp::ADD); break;
-        case '-': vm_.op(VMOp::SUB); break;
-        case '*': vm_.call("Math.multiply", 2); break;
-        case '/': vm_.call("Math.divide", 2); break;
-        case '&': vm_.op(VMOp::AND); break;
-        case '|': vm_.op(VMOp::OR);  break;
-        case '<': vm_.op(VMOp::LT);  break;
-        case '>': vm_.op(VMOp::GT);  break;
-        case '=': vm_.op(VMOp::EQ);  break;
-      }
+      e = mkBinary(op, std::move(e), parseTerm());
     }
+    return e;
   }
-  void compileTerm(){
+  ExprP parseTerm(){
     if (!tz_.hasMore()) throw runtime_error("term expected");
     const Token& t = tz_.peek();
-    if (t.t==TokType::INTC){
-      vm_.push(VMSeg::CONST, t.ival); tz_.advance(); return;
-    }
+    if (t.t==TokType::INTC){ int v=t.ival; tz_.advance(); return mkInt(v); }
     if (t.t==TokType::STRC){
-      string s=t.s; tz_.advance();
-      vm_.push(VMSeg::CONST, (int)s.size());
-      vm_.call("String.new", 1);
-      for (unsigned char c: s){
-        vm_.push(VMSeg::CONST, (int)c);
-        vm_.call("String.appendChar", 2);
-      }
-      return;
+      auto e=make_unique<Expr>(EK::STR); e->s=string(t.s); tz_.advance(); return e;
     }
     if (t.t==TokType::KW){
       switch(t.kw){
-        case Kw::TRUE_:  vm_.push(VMSeg::CONST, 0); vm_.op(VMOp::NOT); tz_.advance(); return;
-        case Kw::FALSE_: case Kw::NULL_: vm_.push(VMSeg::CONST, 0); tz_.advance(); return;
-        case Kw::THIS_:  vm_.push(VMSeg::POINTER, 0); tz_.advance(); return;
+        case Kw::TRUE_:  tz_.advance(); return mkInt(-1);
+        case Kw::FALSE_: case Kw::NULL_: tz_.advance(); return mkInt(0);
+        case Kw::THIS_:  tz_.advance(); return make_unique<Expr>(EK::THIS_);
         default: throw runtime_error("unsupported keyword in term");
       }
     }
     if (t.t==TokType::SYM && t.ch=='('){
-      tz_.advance(); compileExpression(); tz_.expectSym(')', "')'"); return;
+      tz_.advance(); ExprP e=parseExpression(); tz_.expectSym(')', "')'"); return e;
     }
     if (t.t==TokType::SYM && (t.ch=='-' || t.ch=='~')){
       char u = tz_.advance().ch;
-      compileTerm();
-      vm_.op(u=='-'?VMOp::NEG:VMOp::NOT);
-      return;
+      return mkUnary(u, parseTerm());
     }
     if (t.t==TokType::ID){
-      string id = tz_.advance().s;
+      string id(tz_.advance().s);
       if (tz_.isSym('[')){
-        Kind k=st_.kindOf(id); VMSeg sg=kindToSeg(k); int ix=st_.indexOf(id);
-        tz_.advance(); compileExpression(); tz_.expectSym(']', "']'");
-        vm_.push(sg, ix);
-        vm_.op(VMOp::ADD);
-        vm_.pop(VMSeg::POINTER, 1);
-        vm_.push(VMSeg::THAT, 0);
-        return;
-      }
-      if (tz_.isSym('(') || tz_.isSym('.')){
-        subCallWithFirst(id);
-        return;
+        tz_.advance();
+        auto e=make_unique<Expr>(EK::INDEX); e->s=id;
+        e->a.push_back(parseExpression());
+        tz_.expectSym(']', "']'");
+        return e;
       }
-      Kind k=st_.kindOf(id); VMSeg sg=kindToSeg(k); int ix=st_.indexOf(id);
-      vm_.push(sg, ix);
-      return;
+      if (tz_.isSym('(') || tz_.isSym('.')) return parseCall(id);
+      auto e=make_unique<Expr>(EK::VAR); e->s=id;
+      return e;
     }
     throw runtime_error("unrecognized term");
   }
-  int compileExpressionList(){
-    if (tz_.isSym(')')) return 0;
-    int n=1; compileExpression();
-    while (tz_.isSym(',')){ tz_.advance(); compileExpression(); ++n; }
-    return n;
-  }
-  void compileSubroutineCall(){
-    string first = tz_.expectId("call first");
-    subCallWithFirst(first);
-  }
-  void subCallWithFirst(const string& first){
-    string callee;
-    int nArgs=0;
+  ExprP parseCall(const string& first){
+    auto e=make_unique<Expr>(EK::CALL);
     if (tz_.isSym('.')){
       tz_.advance();
       string name2 = tz_.expectId("subName");
-      Kind k = st_.kindOf(first);
-      if (k!=Kind::NONE){
-        vm_.push(kindToSeg(k), st_.indexOf(first));
-        callee = st_.typeOf(first)+"."+name2;
-        nArgs = 1;
+      if (const Sym* v = st_.lookup(first)){
+        auto recv=make_unique<Expr>(EK::VAR); recv->s=first;
+        e->a.push_back(std::move(recv));
+        e->s = st_.typeName(v->type)+"."+name2;
       } else {
-        callee = first+"."+name2;
+        e->s = first+"."+name2;
       }
     } else {
-      vm_.push(VMSeg::POINTER, 0);
-      callee = className_+"."+first;
-      nArgs = 1;
+      e->a.push_back(make_unique<Expr>(EK::THIS_));
+      e->s = className_+"."+first;
     }
     tz_.expectSym('(', "(");
-    nArgs += compileExpressionList();
+    if (!tz_.isSym(')')){
+      e->a.push_back(parseExpression());
+      while (tz_.isSym(',')){ tz_.advance(); e->a.push_back(parseExpression()); }
+    }
     tz_.expectSym(')', ")");
-    vm_.call(callee, nArgs);
+    return e;
+  }
+
+  void label(const string& L){ that_.reset(); if (as_) as_->label(L); else vm_.label(L); }
+  size_t mark() const { return as_ ? as_->mark() : vm_.mark(); }
+  // Runs emit with its output spliced in at an earlier mark().
+  void insertAt(size_t at, const function<void()>& emit){
+    if (as_){ as_->beginInsert(at); emit(); as_->endInsert(); }
+    else { vm_.beginInsert(at); emit(); vm_.endInsert(); }
+  }
+  // A callee may assign fields and statics, but never this frame's locals and arguments.
+  void emitCall(const string& f, int n){
+    vm_.call(f, n);
+    if (that_ && (!inFrame(that_->base) || (!that_->index.empty() && !inFrame(that_->index)))) that_.reset();
+  }
+  bool inFrame(const string& name) const {
+    const Sym* v = st_.lookup(name);
+    return v && (v->k==Kind::VAR || v->k==Kind::ARG);
+  }
+  // Splits an index into a variable part and a constant offset that fits "that k".
+  static bool splitIndex(const Expr& ix, string& var, int& off){
+    if (ix.k==EK::INT && ix.v>=0){ var.clear(); off=ix.v; return true; }
+    if (ix.k==EK::VAR){ var=ix.s; off=0; return true; }
+    if (ix.k==EK::BINARY && ix.op=='+' && ix.a[0]->k==EK::VAR && ix.a[1]->k==EK::INT && ix.a[1]->v>=0){
+      var=ix.a[0]->s; off=ix.a[1]->v; return true;
+    }
+    return false;
+  }
+  // Points THAT at base[index] (or at base+var, reusing it when it is already
+  // there) and returns the "that" offset of the element.
+  int pointThat(const string& base, const Expr& ix){
+    string var; int off;
+    if (!splitIndex(ix, var, off)){
+      emitExpr(ix);
+      pushVar(base);
+      vm_.op(VMOp::ADD);
+      vm_.pop(VMSeg::POINTER, 1);
+      that_.reset();
+      return 0;
+    }
+    if (that_ && that_->base==base && that_->index==var) return off;
+    if (!var.empty()){ pushVar(var); pushVar(base); vm_.op(VMOp::ADD); }
+    else pushVar(base);
+    vm_.pop(VMSeg::POINTER, 1);
+    that_ = ThatKey{base, var};
+    return off;
+  }
+  void go(const string& L){ if (as_) as_->go(L); else vm_.go(L); }
+  void pushVar(const string& name){ Sym v = varOf(name); vm_.push(kindToSeg(v.k), v.idx); }
+  void pushVarTo(const string& name){ Sym v = varOf(name); vm_.pop(kindToSeg(v.k), v.idx); }
+  Sym varOf(const string& name) const { const Sym* v = st_.lookup(name); return v? *v: Sym{}; }
+  void emitInt(int v){
+    if (v>=0) { vm_.push(VMSeg::CONST, v); return; }
+    if (v==-1)     { vm_.push(VMSeg::CONST, 0);     vm_.op(VMOp::NOT); return; }
+    if (v==-32768) { vm_.push(VMSeg::CONST, 32767); vm_.op(VMOp::NOT); return; }
+    vm_.push(VMSeg::CONST, -v); vm_.op(VMOp::NEG);
+  }
+  // Only used for conditions isBool() accepts (any condition under --asm).
+  void emitJumpIfTrue(const Expr& cond, const string& L){
+    if (as_){ as_->jumpIfTrue(cond, L); return; }
+    if (cond.k==EK::INT){ if (cond.v!=0) vm_.go(L); return; }
+    // ~(x = 0) holds exactly when x is nonzero, which if-goto tests directly.
+    if (cond.k==EK::UNARY && cond.a[0]->k==EK::BINARY && cond.a[0]->op=='='){
+      const Expr& eq = *cond.a[0];
+      if (isInt(*eq.a[1], 0)){ emitExpr(*eq.a[0]); vm_.ifgo(L); return; }
+      if (isInt(*eq.a[0], 0)){ emitExpr(*eq.a[1]); vm_.ifgo(L); return; }
+    }
+    emitExpr(cond);
+    vm_.ifgo(L);
+  }
+  void emitJumpIfFalse(const Expr& cond, const string& L){
+    if (as_){ as_->jumpIfFalse(cond, L); return; }
+    if (cond.k==EK::INT){ if (cond.v!=-1) vm_.go(L); return; }   // "not; if-goto" jumps unless v is -1
+    if (cond.k==EK::UNARY && cond.op=='~'){ emitExpr(*cond.a[0]); vm_.ifgo(L); return; }
+    emitExpr(cond);
+    vm_.op(VMOp::NOT);
+    vm_.ifgo(L);
+  }
+  // x * 2^k as k doublings; temp 1 holds the running value between them
+  void emitShifted(const Expr& x, int k){
+    emitExpr(x);
+    if (x.k==EK::VAR || x.k==EK::THIS_){ emitExpr(x); vm_.op(VMOp::ADD); --k; }
+    for (; k>0; --k){
+      vm_.pop(VMSeg::TEMP, 1);
+      vm_.push(VMSeg::TEMP, 1);
+      vm_.push(VMSeg::TEMP, 1);
+      vm_.op(VMOp::ADD);
+    }
+  }
+  void emitExpr(const Expr& e){
+    switch(e.k){
+      case EK::INT: emitInt(e.v); return;
+      case EK::STR:
+        if (opt_.stringPool){ vm_.push(VMSeg::STATIC, poolSlot(intern(e.s))); return; }
+        emitNewString(e.s);
+        return;
+      case EK::THIS_: vm_.push(VMSeg::POINTER, 0); return;
+      case EK::VAR:   pushVar(e.s); return;
+      case EK::INDEX:
+        vm_.push(VMSeg::THAT, pointThat(e.s, *e.a[0]));
+        return;
+      case EK::CALL:
+        for (auto& x: e.a) emitExpr(*x);
+        emitCall(e.s, (int)e.a.size());
+        return;
+      case EK::UNARY:
+        emitExpr(*e.a[0]);
+        vm_.op(e.op=='-' ? VMOp::NEG : VMOp::NOT);
+        return;
+      case EK::BINARY: break;
+    }
+    if (e.op=='*' && e.a[1]->k==EK::INT){
+      int c=e.a[1]->v, k=log2Exact(abs(c));
+      if (k>0){ emitShifted(*e.a[0], k); if (c<0) vm_.op(VMOp::NEG); return; }
+    }
+    emitExpr(*e.a[0]);
+    emitExpr(*e.a[1]);
+    switch(e.op){
+      case '+': vm_.op(VMOp::ADD); break;
+      case '-': vm_.op(VMOp::SUB); break;
+      case '*': emitCall("Math.multiply", 2); break;
+      case '/': emitCall("Math.divide", 2); break;
+      case '&': vm_.op(VMOp::AND); break;
+      case '|': vm_.op(VMOp::OR);  break;
+      case '<': vm_.op(VMOp::LT);  break;
+      case '>': vm_.op(VMOp::GT);  break;
+      case '=': vm_.op(VMOp::EQ);  break;
+    }
   }
 };
 
-static void compileOne(const fs::path& jack){
-  fs::path out = jack; out.replace_extension(".vm");
-  Tokenizer tz(jack.string());
-  VMWriter  vm(out.string());
-  SymbolTable st;
-  Engine eng(tz, vm, st);
-  eng.compileClass();
-  vm.close();
+// Bumped whenever code generation changes; the build stamp covers local edits.
+static const string kCompilerVersion = string("jackc-11.4 ") + __DATE__ + " " + __TIME__;
+
+static uint64_t fnv1a(const string& s, uint64_t h=1469598103934665603ULL){
+  for (unsigned char c: s){ h^=c; h*=1099511628211ULL; }
+  return h;
+}
+
+// Compiled .vm / .s text is cached under the hash of source, compiler version and options.
+class CompileCache {
+public:
+  explicit CompileCache(fs::path dir): dir_(std::move(dir)) { fs::create_directories(dir_); }
+  static string key(const string& src, const Options& opt){
+    string salt = kCompilerVersion + (opt.stringPool ? " pool" : "") + (opt.emitAsm ? " asm" : "") + (opt.loopOpt ? " loop" : "");
+    char buf[17]; snprintf(buf, sizeof buf, "%016llx", (unsigned long long)fnv1a(src, fnv1a(salt)));
+    return buf;
+  }
+  bool get(const string& k, const string& ext, string& text) const {
+    ifstream in(dir_/(k+ext), ios::binary);
+    if (!in) return false;
+    text.assign((istreambuf_iterator<char>(in)), {});
+    return true;
+  }
+  // written under a name unique to this process and thread and renamed only when
+  // complete, so concurrent writers (threads or processes) never expose partial files
+  void put(const string& k, const string& ext, const string& text) const {
+    fs::path tmp = dir_/(k+".tmp"+to_string(getpid())+"."+to_string(hash<thread::id>{}(this_thread::get_id())));
+    bool ok;
+    { ofstream out(tmp, ios::binary); out<<text; out.close(); ok = !out.fail(); }
+    error_code ec;
+    if (ok) fs::rename(tmp, dir_/(k+ext), ec);
+    if (!ok || ec) fs::remove(tmp, ec);
+  }
+private:
+  fs::path dir_;
+};
+
+static void compileOne(const fs::path& jack, const Options& opt, const CompileCache* cache){
+  Stats& stats = Stats::get();
+  const string ext = opt.emitAsm ? ".s" : ".vm";
+  fs::path out = jack; out.replace_extension(ext);
+  string src;
+  { auto timer = stats.time("read"); src = readFile(jack.string()); }
+  stats.add("bytes_in", (long long)src.size());
+  string k, text;
+  if (cache) k = CompileCache::key(src, opt);
+  if (!cache || !cache->get(k, ext, text)){
+    auto timer = stats.time("tokenize");
+    Tokenizer tz(jack.string(), std::move(src));
+    stats.add("tokens", (long long)tz.size());
+    VMWriter  vm;
+    SymbolTable st;
+    AsmWriter as(st);
+    Engine eng(tz, vm, st, opt, opt.emitAsm ? &as : nullptr);
+    { auto inner = stats.time("compile"); eng.compileClass(); }
+    text = opt.emitAsm ? as.text() : vm.text();
+    if (stats.on()){
+      stats.add("symbols", st.defined());
+      if (opt.emitAsm) stats.add("instructions", Stats::asmInstructions(text));
+      else stats.add("vm_commands", (long long)vm.code().size());
+    }
+    if (cache) cache->put(k, ext, text);
+  } else stats.add("cache_hits", 1);
+  auto timer = stats.time("write");
+  ofstream o(out, ios::binary);
+  if (!o) throw runtime_error("cannot open output: "+out.string());
+  o<<text;
+  stats.add("bytes_out", (long long)text.size());
+  // the translator links Foo.s only when there is no Foo.vm beside it
+  if (opt.emitAsm){ error_code ec; fs::remove(fs::path(jack).replace_extension(".vm"), ec); }
+}
+
+// Tokenizes every .jack file under root, concatenated and repeated up to mb megabytes.
+static int benchTokenizer(const fs::path& root, int mb){
+  vector<fs::path> files;
+  for (auto& e: fs::recursive_directory_iterator(root))
+    if (e.is_regular_file() && e.path().extension()==".jack") files.push_back(e.path());
+  if (files.empty()) return 1;
+  sort(files.begin(), files.end());
+  string one, corpus;
+  for (auto& f: files){ one += readFile(f.string()); one += '\n'; }
+  while (corpus.size() < (size_t)mb<<20) corpus += one;
+  double best = 1e30;
+  size_t toks = 0, names = 0;
+  for (int r=0; r<5; ++r){
+    string copy = corpus;
+    auto t0 = chrono::steady_clock::now();
+    Tokenizer tz("<corpus>", std::move(copy));
+    best = min(best, chrono::duration<double>(chrono::steady_clock::now()-t0).count());
+    toks = tz.size(); names = tz.names();
+  }
+  printf("%zu files, %.1f MB: %zu tokens, %zu names, %.2f ms (%.0f MB/s)\n",
+         files.size(), corpus.size()/1048576.0, toks, names, best*1e3, corpus.size()/1048576.0/best);
+  return 0;
 }
 
 int main(int argc, char** argv){
-  if (argc!=2) return 1;
-  fs::path p(argv[1]);
+  Options opt;
+  fs::path p;
+  unsigned jobs = max(1u, thread::hardware_concurrency());
+  bool useCache = false;
+  fs::path cacheDir;
+  int benchMB = 0;
+  for (int i=1; i<argc; ++i){
+    string a = argv[i];
+    if (a=="--string-pool") opt.stringPool = true;
+    else if (a=="--asm") opt.emitAsm = true;
+    else if (a=="--loop-opt") opt.loopOpt = true;
+    else if (a.rfind("--jobs=",0)==0) jobs = max(1, stoi(a.substr(7)));
+    else if (a=="--cache") useCache = true;
+    else if (a=="--bench-tokenizer") benchMB = 8;
+    else if (a.rfind("--bench-tokenizer=",0)==0) benchMB = max(1, stoi(a.substr(18)));
+    else if (a.rfind("--cache=",0)==0){ useCache = true; cacheDir = a.substr(8); }
+    else if (Stats::get().parseFlag(a, "compiler")) continue;
+    else if (p.empty()) p = a;
+    else return 1;
+  }
+  if (p.empty()) return 1;
+  if (benchMB) return benchTokenizer(p, benchMB);
   vector<fs::path> files;
   if (fs::is_directory(p)){
     for (auto& e: fs::directory_iterator(p))
@@ -519,6 +1360,30 @@ int main(int argc, char** argv){
   } else {
     return 1;
   }
-  for (auto& f: files) compileOne(f);
-  return 0;
+  sort(files.begin(), files.end());
+
+  unique_ptr<CompileCache> cache;
+  if (useCache){
+    if (cacheDir.empty()) cacheDir = (fs::is_directory(p) ? p : p.parent_path()) / ".jackcache";
+    cache = make_unique<CompileCache>(cacheDir);
+  }
+
+  // Tokenizer, SymbolTable, Engine and LabelGen are all per class, so classes compile independently.
+  vector<string> errors(files.size());
+  atomic<size_t> next{0};
+  auto worker = [&]{
+    for (size_t i; (i = next++) < files.size(); ){
+      try { compileOne(files[i], opt, cache.get()); }
+      catch (const exception& e){ errors[i] = files[i].string()+": "+e.what(); }
+    }
+  };
+  vector<thread> pool;
+  for (unsigned t=1; t<min<size_t>(jobs, files.size()); ++t) pool.emplace_back(worker);
+  worker();
+  for (auto& t: pool) t.join();
+  Stats::get().add("files", (long long)files.size());
+
+  int rc = 0;
+  for (auto& e: errors) if (!e.empty()){ cerr<<e<<'\n'; rc = 1; }
+  return rc;
 }
@@ -0,0 +1,20 @@
+// Feeds compiled VM records to the LAB8 translator's AsmWriter without going
+// through .vm text. Include after the jack and vm namespaces (see pipeline.cpp).
+#pragma once
+
+static void lower(const std::vector<jack::VMInstr>& code, vm::AsmWriter& W){
+  using I = jack::VMInstr;
+  for (auto& c: code){
+    switch(c.k){
+      case I::PUSH:     W.writePushPop(vm::T_PUSH, jack::VMWriter::seg(c.seg), c.n); break;
+      case I::POP:      W.writePushPop(vm::T_POP, jack::VMWriter::seg(c.seg), c.n); break;
+      case I::OP:       W.writeArithmetic(jack::VMWriter::opname(c.op)); break;
+      case I::LABEL:    W.writeLabel(c.name); break;
+      case I::GOTO:     W.writeGoto(c.name); break;
+      case I::IFGOTO:   W.writeIf(c.name); break;
+      case I::CALL:     W.writeCall(c.name, c.n); break;
+      case I::FUNCTION: W.writeFunction(c.name, c.n); break;
+      case I::RETURN:   W.writeReturn(); break;
+    }
+  }
+}
@@ -0,0 +1,265 @@
+// Jack sources to a .hack image in one process. The LAB11 Engine hands VM
+// records straight to the LAB8 AsmWriter, whose output is decoded once into
+// Hack instruction records and encoded with the LAB6 tables; .vm/.asm text is
+// only written when asked for with --dump-vm / --dump-asm.
+#include <bits/stdc++.h>
+#include <filesystem>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "../stats.h"          // before the tools below, so they share it
+
+// Each tool is a single translation unit with its own main(); they are pulled
+// in under a namespace apiece so their names (two AsmWriters, ...) stay apart.
+namespace jack {
+#include "compiler.cpp"
+}
+namespace vm {
+#include "../LAB8/translator.cpp"
+}
+namespace hack {
+#include "../LAB6/assembler.cpp"
+}
+#include "lower.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Wall time and peak resident set after each stage.
+class StageClock {
+public:
+  void lap(const string& stage){
+    auto t = chrono::steady_clock::now();
+    rusage u{}; getrusage(RUSAGE_SELF, &u);
+    rows_.push_back({stage, chrono::duration<double, milli>(t-t0_).count(), u.ru_maxrss});
+    t0_ = t;
+  }
+  void report(ostream& o) const {
+    double total = 0;
+    o<<"stage        wall ms   peak KB\n";
+    for (auto& r: rows_){
+      total += r.ms;
+      o<<left<<setw(10)<<r.stage<<right<<setw(10)<<fixed<<setprecision(2)<<r.ms<<setw(10)<<r.peakKb<<'\n';
+    }
+    o<<left<<setw(10)<<"total"<<right<<setw(10)<<fixed<<setprecision(2)<<total<<'\n';
+  }
+private:
+  struct Row { string stage; double ms; long peakKb; };
+  vector<Row> rows_;
+  chrono::steady_clock::time_point t0_ = chrono::steady_clock::now();
+};
+
+// One class of the program: Jack source, or a .vm / .s file with no .jack beside it.
+struct Unit {
+  enum Kind : int { JACK, VM, ASM } kind;
+  string cls;
+  fs::path path;
+  string src;
+  vector<jack::VMInstr> code;    // compiled VM records
+  string asmText;                // --asm output, or a linked .s file
+  vm::AsmWriter out;
+};
+
+// Hack instructions decoded from assembly text; symbolic A-instructions keep a
+// symbol id until labels and variables are placed.
+struct HackInstr {
+  enum Kind { VALUE, SYMBOL, C } kind;
+  uint16_t bits;
+  uint32_t sym;
+};
+
+class HackAssembler {
+public:
+  HackAssembler(){
+    auto table = [](const map<string,string>& m, unordered_map<string,uint16_t>& t){
+      for (auto& [k, v]: m) t[k] = (uint16_t)stoi(v, nullptr, 2);
+    };
+    table(hack::dest_map, dest_); table(hack::comp_map, comp_); table(hack::jump_map, jump_);
+    for (auto& [k, v]: hack::symbols){ ids_[k] = (uint32_t)vals_.size(); vals_.push_back(v); }
+  }
+
+  void decode(const string& text){
+    string ln, sym;
+    size_t lineNo = 0;
+    for (size_t i=0; i<text.size(); ){
+      size_t e = text.find('\n', i);
+      if (e==string::npos) e = text.size();
+      ++lineNo;
+      ln.clear();
+      for (size_t j=i; j<e; ++j){
+        char c = text[j];
+        if (c=='/' && j+1<e && text[j+1]=='/') break;
+        if (!isspace((unsigned char)c)) ln += c;
+      }
+      i = e+1;
+      if (ln.empty()) continue;
+      if (ln[0]=='('){ sym.assign(ln, 1, ln.size()-2); vals_[id(sym)] = (int)prog_.size(); continue; }
+      if (ln[0]=='@'){
+        sym.assign(ln, 1);
+        if (hack::is_number(sym)) prog_.push_back({HackInstr::VALUE, (uint16_t)stoi(sym), 0});
+        else prog_.push_back({HackInstr::SYMBOL, 0, id(sym)});
+        continue;
+      }
+      prog_.push_back({HackInstr::C, encodeC(ln, lineNo), 0});
+    }
+  }
+
+  // Unplaced symbols become variables from RAM[16] on, in order of first use.
+  vector<uint16_t> link(){
+    int next = 16;
+    vector<uint16_t> words;
+    words.reserve(prog_.size());
+    for (auto& in: prog_){
+      if (in.kind==HackInstr::SYMBOL){
+        if (vals_[in.sym] < 0) vals_[in.sym] = next++;
+        words.push_back((uint16_t)vals_[in.sym]);
+      } else words.push_back(in.bits);
+    }
+    return words;
+  }
+
+private:
+  unordered_map<string,uint16_t> dest_, comp_, jump_;
+  unordered_map<string,uint32_t> ids_;
+  vector<int> vals_;             // -1 until the label or variable is placed
+  vector<HackInstr> prog_;
+
+  uint32_t id(const string& s){
+    auto it = ids_.find(s);
+    if (it!=ids_.end()) return it->second;
+    ids_.emplace(s, (uint32_t)vals_.size());
+    vals_.push_back(-1);
+    return (uint32_t)vals_.size()-1;
+  }
+  uint16_t encodeC(const string& ln, size_t lineNo) const {
+    size_t eq = ln.find('='), sc = ln.find(';');
+    string dest = eq==string::npos ? "null" : ln.substr(0, eq);
+    size_t c0 = eq==string::npos ? 0 : eq+1;
+    string comp = ln.substr(c0, sc==string::npos ? string::npos : sc-c0);
+    string jump = sc==string::npos ? "null" : ln.substr(sc+1);
+    auto d = dest_.find(dest), c = comp_.find(comp), j = jump_.find(jump);
+    if (d==dest_.end() || c==comp_.end() || j==jump_.end())
+      throw runtime_error("assembly line "+to_string(lineNo)+": cannot encode '"+ln+"'");
+    return (uint16_t)(0xE000 | c->second<<6 | d->second<<3 | j->second);
+  }
+};
+
+static void writeText(const fs::path& p, const string& text){
+  ofstream o(p, ios::binary);
+  if (!o) throw runtime_error("cannot open output: "+p.string());
+  o<<text;
+}
+
+int main(int argc, char** argv){
+  jack::Options opt;
+  vm::Policy policy = vm::P_SPEED;
+  unsigned jobs = max(1u, thread::hardware_concurrency());
+  bool dumpVm = false, dumpAsm = false;
+  vector<fs::path> inputs;
+  for (int i=1; i<argc; ++i){
+    string a = argv[i];
+    if (a=="--string-pool") opt.stringPool = true;
+    else if (a=="--asm") opt.emitAsm = true;
+    else if (a=="--loop-opt") opt.loopOpt = true;
+    else if (a=="--policy=size") policy = vm::P_SIZE;
+    else if (a=="--policy=speed") policy = vm::P_SPEED;
+    else if (a.rfind("--jobs=",0)==0) jobs = max(1, stoi(a.substr(7)));
+    else if (a=="--dump-vm") dumpVm = true;
+    else if (a=="--dump-asm") dumpAsm = true;
+    else inputs.push_back(a);
+  }
+  if (inputs.empty() || !fs::is_directory(inputs[0])){
+    cerr<<"Usage: "<<argv[0]<<" [--asm] [--string-pool] [--loop-opt] [--policy=speed|size] [--jobs=N]"
+          " [--dump-vm] [--dump-asm] <program dir> [more dirs, e.g. the OS]\n";
+    return 1;
+  }
+  fs::path outDir = inputs[0];
+  if (!outDir.has_filename()) outDir = outDir.parent_path();
+  fs::path outBase = outDir / outDir.filename();
+
+  StageClock clock;
+  vector<Unit> units;
+  try {
+    // A class comes from its first directory; within one, .jack beats .vm beats .s.
+    map<string, Unit::Kind> seen;
+    for (auto& dir: inputs){
+      map<string, pair<Unit::Kind, fs::path>> here;
+      for (auto& e: fs::directory_iterator(dir)){
+        string ext = e.path().extension().string();
+        if ((ext!=".jack" && ext!=".vm" && ext!=".s") || !e.is_regular_file()) continue;
+        Unit::Kind k = ext==".jack" ? Unit::JACK : ext==".vm" ? Unit::VM : Unit::ASM;
+        auto [it, fresh] = here.try_emplace(e.path().stem().string(), k, e.path());
+        if (!fresh && k < it->second.first) it->second = {k, e.path()};
+      }
+      for (auto& [cls, kp]: here)
+        if (seen.emplace(cls, kp.first).second){
+          Unit u{kp.first, cls, kp.second, {}, {}, {}, vm::AsmWriter(policy)};
+          if (u.kind!=Unit::VM) u.src = jack::readFile(u.path.string());
+          units.push_back(std::move(u));
+        }
+    }
+    sort(units.begin(), units.end(), [](const Unit& x, const Unit& y){ return x.cls < y.cls; });
+    clock.lap("read");
+
+    auto parallel = [&](const function<void(Unit&)>& f){
+      vector<string> errors(units.size());
+      atomic<size_t> next{0};
+      auto worker = [&]{
+        for (size_t i; (i = next++) < units.size(); ){
+          try { f(units[i]); }
+          catch (const exception& e){ errors[i] = units[i].path.string()+": "+e.what(); }
+        }
+      };
+      vector<thread> pool;
+      for (unsigned t=1; t<min<size_t>(jobs, units.size()); ++t) pool.emplace_back(worker);
+      worker();
+      for (auto& t: pool) t.join();
+      for (auto& e: errors) if (!e.empty()) throw runtime_error(e);
+    };
+
+    parallel([&](Unit& u){
+      if (u.kind!=Unit::JACK) return;
+      jack::Tokenizer tz(u.path.string(), std::move(u.src));
+      jack::VMWriter vmw;
+      jack::SymbolTable st;
+      jack::AsmWriter as(st);
+      jack::Engine eng(tz, vmw, st, opt, opt.emitAsm ? &as : nullptr);
+      eng.compileClass();
+      if (opt.emitAsm) u.asmText = as.text();
+      else u.code = vmw.code();
+      if (dumpVm) writeText(fs::path(u.path).replace_extension(opt.emitAsm ? ".s" : ".vm"), opt.emitAsm ? u.asmText : vmw.text());
+    });
+    clock.lap("compile");
+
+    // Same layout as the LAB8 translator on a directory: bootstrap, VM classes, then .s classes.
+    parallel([&](Unit& u){
+      if (u.kind==Unit::ASM) return;
+      if (u.kind==Unit::VM) vm::translateFile(u.path.string(), u.out);
+      else if (!opt.emitAsm){ u.out.setModule(u.cls); lower(u.code, u.out); }
+    });
+    vm::AsmWriter W(policy);
+    W.bootstrap();
+    for (auto& u: units) if (u.kind==Unit::VM || (u.kind==Unit::JACK && !opt.emitAsm)) W.merge(u.out);
+    for (auto& u: units) if (u.kind==Unit::ASM || (u.kind==Unit::JACK && opt.emitAsm)) W.out<<(u.kind==Unit::ASM ? u.src : u.asmText);
+    W.writeSharedRoutines();
+    string asmText = W.out.str();
+    clock.lap("translate");
+
+    HackAssembler hasm;
+    hasm.decode(asmText);
+    vector<uint16_t> words = hasm.link();
+    clock.lap("assemble");
+
+    string image(words.size()*17, '\n');
+    for (size_t i=0; i<words.size(); ++i)
+      for (int b=0; b<16; ++b) image[i*17+b] = char('0'+(words[i]>>(15-b) & 1));
+    writeText(fs::path(outBase).replace_extension(".hack"), image);
+    if (dumpAsm) writeText(fs::path(outBase).replace_extension(".asm"), asmText);
+    clock.lap("write");
+    cerr<<outBase.string()<<".hack: "<<words.size()<<" words from "<<units.size()<<" classes\n";
+  } catch (const exception& e){
+    cerr<<e.what()<<'\n';
+    return 1;
+  }
+  clock.report(cerr);
+  return 0;
+}
@@ -0,0 +1,292 @@
+// The Jack compiler as a long-running server on a Unix domain socket. Classes
+// stay in memory between requests, tokenized and compiled, keyed by path and
+// checked against the file's mtime and size, so a request only recompiles what
+// changed on disk. client.cpp is the command-line front end.
+//
+// A request is the client's arguments, each NUL-terminated, then one more NUL.
+// The reply is a run of records "<tag> <length> <path>\n<length bytes>" where
+// the tag is file (output text), rm (stale output to delete) or diag (message),
+// closed by "end <rc> <rebuilt> <classes> <server us>\n".
+#include <bits/stdc++.h>
+#include <filesystem>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../stats.h"          // before the tools below, so they share it
+
+namespace jack {
+#include "compiler.cpp"
+}
+namespace vm {
+#include "../LAB8/translator.cpp"
+}
+#include "lower.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static string defaultSocket(){
+  if (const char* s = getenv("JACKD_SOCKET")) return s;
+  return "/tmp/jackd-"+to_string(getuid())+".sock";
+}
+
+struct Request {
+  jack::Options opt;
+  bool lowerVm{false};          // also link everything into one .asm with the LAB8 translator
+  vm::Policy policy{vm::P_SPEED};
+  bool shutdown{false};
+  fs::path path;
+};
+
+// A source file as last read from disk: a .jack class keeps its tokens and its
+// output per option set; a .vm file with no .jack beside it is only lowered.
+struct ClassEntry {
+  struct Output {
+    string text;                              // .vm or .s text
+    vector<jack::VMInstr> code;
+    unique_ptr<vm::AsmWriter> lowered[2];     // by vm::Policy
+  };
+  bool isVm{false};
+  fs::file_time_type mtime{};
+  uintmax_t size{0};
+  unique_ptr<jack::Tokenizer> tz;
+  map<string, Output> out;                    // by optionKey()
+};
+
+class Server {
+public:
+  explicit Server(unsigned jobs): jobs_(jobs) {}
+
+  // Fills reply with the records for one request and returns its exit code.
+  int handle(const Request& rq, string& reply){
+    auto t0 = chrono::steady_clock::now();
+    vector<fs::path> files;
+    string err = collect(rq, files);
+    if (!err.empty()){ record(reply, "diag", "", err); return finish(reply, 1, 0, 0, t0); }
+
+    const string key = optionKey(rq.opt);
+    vector<ClassEntry*> entries;
+    for (auto& f: files){
+      ClassEntry& e = cache_[f.string()];
+      e.isVm = f.extension()==".vm";
+      entries.push_back(&e);
+    }
+
+    // Entries are distinct, so workers share nothing but the counters.
+    vector<string> errors(files.size());
+    atomic<size_t> next{0}, rebuilt{0};
+    auto worker = [&]{
+      for (size_t i; (i = next++) < files.size(); ){
+        try { if (refresh(files[i], *entries[i], key, rq)) ++rebuilt; }
+        catch (const exception& e){ errors[i] = files[i].string()+": "+e.what(); }
+      }
+    };
+    vector<thread> pool;
+    for (unsigned t=1; t<min<size_t>(jobs_, files.size()); ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& t: pool) t.join();
+
+    int rc = 0;
+    for (auto& e: errors) if (!e.empty()){ record(reply, "diag", "", e); rc = 1; }
+    for (size_t i=0; i<files.size(); ++i){
+      if (entries[i]->isVm || !errors[i].empty()) continue;
+      fs::path out = files[i]; out.replace_extension(rq.opt.emitAsm ? ".s" : ".vm");
+      record(reply, "file", out.string(), entries[i]->out[key].text);
+      // the translator links Foo.s only when there is no Foo.vm beside it
+      if (rq.opt.emitAsm) record(reply, "rm", fs::path(files[i]).replace_extension(".vm").string(), "");
+    }
+    if (rq.lowerVm && rc==0) link(rq, files, entries, key, reply);
+    return finish(reply, rc, rebuilt, files.size(), t0);
+  }
+
+private:
+  unsigned jobs_;
+  map<string, ClassEntry> cache_;
+
+  static string optionKey(const jack::Options& o){
+    return string(o.stringPool ? "pool " : "") + (o.emitAsm ? "asm " : "") + (o.loopOpt ? "loop" : "");
+  }
+  static void record(string& r, const char* tag, const string& path, const string& body){
+    r += tag; r += ' '; r += to_string(body.size()); r += ' '; r += path; r += '\n'; r += body;
+  }
+  static int finish(string& r, int rc, size_t rebuilt, size_t classes, chrono::steady_clock::time_point t0){
+    auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-t0).count();
+    r += "end "+to_string(rc)+" "+to_string(rebuilt)+" "+to_string(classes)+" "+to_string(us)+"\n";
+    return rc;
+  }
+
+  // The .jack files of a directory (and, when lowering, its .vm files with no
+  // .jack beside them, such as the OS), or a single .jack file.
+  string collect(const Request& rq, vector<fs::path>& files){
+    error_code ec;
+    if (fs::is_directory(rq.path, ec)){
+      set<string> jackStems;
+      vector<fs::path> vms;
+      for (auto& e: fs::directory_iterator(rq.path, ec)){
+        if (!e.is_regular_file()) continue;
+        if (e.path().extension()==".jack"){ files.push_back(e.path()); jackStems.insert(e.path().stem().string()); }
+        else if (rq.lowerVm && e.path().extension()==".vm") vms.push_back(e.path());
+      }
+      for (auto& v: vms) if (!jackStems.count(v.stem().string())) files.push_back(v);
+      sort(files.begin(), files.end());
+      // forget classes deleted from this directory
+      for (auto it = cache_.begin(); it!=cache_.end(); )
+        if (fs::path(it->first).parent_path()==rq.path && !fs::exists(it->first, ec)) it = cache_.erase(it);
+        else ++it;
+    } else if (rq.path.extension()==".jack" && fs::is_regular_file(rq.path, ec)){
+      files.push_back(rq.path);
+    }
+    if (files.empty()) return rq.path.string()+": no .jack sources";
+    return "";
+  }
+
+  // Brings one entry up to date for this request; true if it was recompiled.
+  static bool refresh(const fs::path& f, ClassEntry& e, const string& key, const Request& rq){
+    auto mtime = fs::last_write_time(f);
+    auto size = fs::file_size(f);
+    if (mtime!=e.mtime || size!=e.size || (!e.isVm && !e.tz)){
+      e.out.clear(); e.tz.reset(); e.mtime = {};   // stays stale if reading fails
+      if (!e.isVm) e.tz = make_unique<jack::Tokenizer>(f.string());
+      e.mtime = mtime; e.size = size;
+    }
+    bool compiled = false;
+    ClassEntry::Output& o = e.out[e.isVm ? "" : key];
+    if (!e.isVm && o.text.empty()){
+      e.tz->rewind();
+      jack::VMWriter vmw;
+      jack::SymbolTable st;
+      jack::AsmWriter as(st);
+      jack::Engine eng(*e.tz, vmw, st, rq.opt, rq.opt.emitAsm ? &as : nullptr);
+      try { eng.compileClass(); }
+      catch (...){ e.out.erase(key); throw; }
+      o.text = rq.opt.emitAsm ? as.text() : vmw.text();
+      if (!rq.opt.emitAsm) o.code = vmw.code();
+      compiled = true;
+    }
+    if (rq.lowerVm && !(rq.opt.emitAsm && !e.isVm) && !o.lowered[rq.policy]){
+      auto W = make_unique<vm::AsmWriter>(rq.policy);
+      if (e.isVm) vm::translateFile(f.string(), *W);
+      else { W->setModule(f.stem().string()); lower(o.code, *W); }
+      o.lowered[rq.policy] = std::move(W);
+    }
+    return compiled;
+  }
+
+  // Same layout as the LAB8 translator: bootstrap (for a directory), the VM
+  // classes in path order, then the classes compiled straight to assembly.
+  void link(const Request& rq, const vector<fs::path>& files, const vector<ClassEntry*>& entries,
+            const string& key, string& reply){
+    bool dir = fs::is_directory(rq.path);
+    vm::AsmWriter W(rq.policy);
+    if (dir) W.bootstrap();
+    for (auto* e: entries){
+      auto& o = e->out[e->isVm ? "" : key];
+      if (o.lowered[rq.policy]) W.merge(*o.lowered[rq.policy]);
+    }
+    for (auto* e: entries) if (!e->isVm && rq.opt.emitAsm) W.out<<e->out[key].text;
+    W.writeSharedRoutines();
+    fs::path out = dir ? rq.path/rq.path.filename() : files[0];
+    out.replace_extension(".asm");
+    record(reply, "file", out.string(), W.out.str());
+  }
+};
+
+static bool parseRequest(const vector<string>& args, Request& rq, string& err){
+  for (auto& a: args){
+    if (a=="--string-pool") rq.opt.stringPool = true;
+    else if (a=="--asm") rq.opt.emitAsm = true;
+    else if (a=="--loop-opt") rq.opt.loopOpt = true;
+    else if (a=="--lower" || a=="--lower=speed"){ rq.lowerVm = true; rq.policy = vm::P_SPEED; }
+    else if (a=="--lower=size"){ rq.lowerVm = true; rq.policy = vm::P_SIZE; }
+    else if (a=="--shutdown") rq.shutdown = true;
+    else if (!a.empty() && a[0]=='-'){ err = "unknown option: "+a; return false; }
+    else if (rq.path.empty()) rq.path = fs::path(a).lexically_normal();
+    else { err = "more than one path given"; return false; }
+  }
+  if (rq.path.empty() && !rq.shutdown){ err = "no path given"; return false; }
+  if (!rq.path.empty() && !rq.path.is_absolute()){ err = "paths must be absolute: "+rq.path.string(); return false; }
+  if (!rq.path.has_filename()) rq.path = rq.path.parent_path();
+  return true;
+}
+
+// Arguments arrive NUL-terminated; an empty one ends the request.
+static bool readRequest(int fd, vector<string>& args){
+  string buf;
+  char chunk[4096];
+  auto done = [&]{ return buf=="" ? false : buf.size()==1 ? buf[0]=='\0' : buf.compare(buf.size()-2, 2, string(2, '\0'))==0; };
+  while (!done()){
+    ssize_t n = read(fd, chunk, sizeof chunk);
+    if (n<=0) return false;
+    buf.append(chunk, n);
+  }
+  for (size_t i=0; i+1<buf.size(); ){
+    size_t e = buf.find('\0', i);
+    args.push_back(buf.substr(i, e-i));
+    i = e+1;
+  }
+  return true;
+}
+
+static void sendAll(int fd, const string& s){
+  for (size_t off=0; off<s.size(); ){
+    ssize_t n = send(fd, s.data()+off, s.size()-off, MSG_NOSIGNAL);
+    if (n<=0) return;
+    off += n;
+  }
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+int main(int argc, char** argv){
+  string sock = defaultSocket();
+  unsigned jobs = max(1u, thread::hardware_concurrency());
+  for (int i=1; i<argc; ++i){
+    string a = argv[i];
+    if (a.rfind("--socket=",0)==0) sock = a.substr(9);
+    else if (a.rfind("--jobs=",0)==0) jobs = max(1, stoi(a.substr(7)));
+    else { cerr<<"Usage: "<<argv[0]<<" [--socket=PATH] [--jobs=N]\n"; return 1; }
+  }
+
+  int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (sock.size()>=sizeof addr.sun_path){ cerr<<"socket path too long: "<<sock<<'\n'; return 1; }
+  strcpy(addr.sun_path, sock.c_str());
+  unlink(sock.c_str());
+  if (lfd<0 || bind(lfd, (sockaddr*)&addr, sizeof addr)<0 || listen(lfd, 64)<0){
+    cerr<<sock<<": "<<strerror(errno)<<'\n';
+    return 1;
+  }
+  // no SA_RESTART, so a signal breaks accept() and the socket file is removed
+  struct sigaction sa{};
+  sa.sa_handler = [](int){ stopping = 1; };
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  cerr<<"listening on "<<sock<<'\n';
+
+  // Requests are served one at a time; each one compiles its classes in parallel.
+  Server server(jobs);
+  while (!stopping){
+    int fd = accept(lfd, nullptr, nullptr);
+    if (fd<0){ if (errno==EINTR) continue; break; }
+    vector<string> args;
+    if (readRequest(fd, args)){
+      Request rq;
+      string reply, err;
+      try {
+        if (!parseRequest(args, rq, err)) reply = "diag "+to_string(err.size())+" \n"+err+"end 2 0 0 0\n";
+        else if (rq.shutdown){ reply = "end 0 0 0 0\n"; stopping = 1; }
+        else server.handle(rq, reply);
+      } catch (const exception& e){
+        err = e.what(); reply = "diag "+to_string(err.size())+" \n"+err+"end 1 0 0 0\n";
+      }
+      sendAll(fd, reply);
+      if (!rq.shutdown) cerr<<rq.path.string()<<": "<<reply.substr(reply.rfind("end "));
+    }
+    close(fd);
+  }
+  close(lfd);
+  unlink(sock.c_str());
+  return 0;
+}
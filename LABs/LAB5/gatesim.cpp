@@ -0,0 +1,329 @@
+#include <bits/stdc++.h>
+#include "../hdl.h"
+using namespace std;
+
+// Gate-level simulator for the LAB1-LAB5 chips, driven by their .tst scripts.
+// The chip is flattened to Nand and DFF primitives (hdl.h) and evaluated by a
+// pool of threads.
+//
+// Every instance of a --split chip (by default the RAM64 -> RAM16K hierarchy of
+// LAB3 and the Screen) is a partition, with the rest of the chip in partition
+// 0. A gate's stage is the number of partition boundaries on its deepest input
+// path, so within a stage each partition only reads its own gates and earlier
+// stages. Threads own whole partitions (balanced by gate count) and evaluate
+// their gates for a stage in partition order, level by level, with one barrier
+// per stage instead of one per logic level. A clock edge is two more phases:
+// every thread samples its DFF inputs, then commits them at the start of the
+// next evaluation.
+
+class Barrier {
+public:
+    explicit Barrier(int n) : n_(n) {}
+    void wait() {
+        uint32_t phase = phase_.load(memory_order_acquire);
+        if (arrived_.fetch_add(1, memory_order_acq_rel) + 1 == n_) {
+            arrived_.store(0, memory_order_relaxed);
+            phase_.fetch_add(1, memory_order_release);
+            return;
+        }
+        for (int spin = 0; phase_.load(memory_order_acquire) == phase; ++spin)
+            if (spin > 64) this_thread::yield();
+    }
+
+private:
+    const uint32_t n_;
+    atomic<uint32_t> arrived_{0}, phase_{0};
+};
+
+class GateSim : public hdl::Target {
+public:
+    GateSim(hdl::Netlist nl, int threads) : nl_(move(nl)), threads_(threads), barrier_(threads) {
+        rom_.assign(32768, 0);
+        schedule();
+        for (int t = 1; t < threads_; ++t) pool_.emplace_back([this, t] { worker(t); });
+    }
+    ~GateSim() override {
+        if (threads_ > 1) parallel(QUIT);
+        for (auto& th : pool_) th.join();
+    }
+
+    int stages() const { return stages_; }
+    double balance() const { return balance_; }   // largest thread's share of the gates over the mean
+    size_t nands() const { return nands_; }
+    size_t dffs() const { return nl_.dffs.size(); }
+    uint32_t partitions() const { return nl_.partitions; }
+
+    int width(const string& pin) override {
+        const hdl::Netlist::Port* p = nl_.port(pin);
+        return p ? static_cast<int>(p->bits.size()) : -1;
+    }
+    void set(const string& pin, uint64_t value) override {
+        for (const auto& p : nl_.inputs) {
+            if (p.name != pin) continue;
+            for (size_t i = 0; i < p.bits.size(); ++i) v_[p.bits[i]] = value >> i & 1;
+            dirty_ = true;
+            return;
+        }
+        throw runtime_error("cannot set output pin " + pin);
+    }
+    uint64_t get(const string& pin) override {
+        settle();
+        uint64_t x = 0;
+        const auto& bits = nl_.port(pin)->bits;
+        for (size_t i = 0; i < bits.size(); ++i) x |= uint64_t(v_[bits[i]]) << i;
+        return x;
+    }
+    bool getState(const string& chip, int index, uint64_t& value) override {
+        settle();
+        if (chip == "ROM32K") { if (index < 0 || index >= 32768) return false; value = rom_[index]; return true; }
+        if (chip == "Keyboard") { value = keyboard_; return !nl_.keyboards.empty(); }
+        uint32_t first;
+        if (!nl_.word(chip, index, first)) return false;
+        value = 0;
+        for (int b = 0; b < 16 && first + b < nl_.dffs.size(); ++b) value |= uint64_t(dff(first + b)) << b;
+        return true;
+    }
+    bool setState(const string& chip, int index, uint64_t value) override {
+        settle();
+        if (chip == "ROM32K") { if (index < 0 || index >= 32768) return false; rom_[index] = value; dirty_ = true; return true; }
+        if (chip == "Keyboard") {
+            keyboard_ = static_cast<uint16_t>(value);
+            for (const auto& k : nl_.keyboards)
+                for (int b = 0; b < 16; ++b) v_[k[b]] = value >> b & 1;
+            dirty_ = true;
+            return !nl_.keyboards.empty();
+        }
+        uint32_t first;
+        if (!nl_.word(chip, index, first)) return false;
+        for (int b = 0; b < 16 && first + b < nl_.dffs.size(); ++b)
+            v_[nl_.dffs[first + b].out] = next_[first + b] = value >> b & 1;
+        dirty_ = true;
+        return true;
+    }
+    bool loadRom(const string& file) override {
+        if (!hdl::loadHack(file, rom_)) return false;
+        dirty_ = true;
+        return true;
+    }
+    void eval() override { dirty_ = true; settle(); }
+    void tick() override { settle(); parallel(SAMPLE); sampled_ = true; }
+    void tock() override { commit_ = dirty_ = true; sampled_ = false; }
+
+private:
+    enum Job { EVAL, COMMIT_EVAL, SAMPLE, QUIT };
+    static constexpr uint32_t ROM = UINT32_MAX;   // Gate::a of a ROM32K read; b is its index in nl_.roms
+    // Nets are renumbered so that gate i of work_[t][s] drives net base_[t][s] + i.
+    struct Gate { uint32_t a, b; };
+
+    hdl::Netlist nl_;
+    int threads_;
+    Barrier barrier_;
+    vector<thread> pool_;
+    atomic<int> job_{EVAL};
+    vector<uint8_t> v_, next_;
+    vector<vector<vector<Gate>>> work_;   // [thread][stage], partition-major, level order within a partition
+    vector<vector<uint32_t>> base_;       // [thread][stage]
+    vector<vector<uint32_t>> dffsOf_;     // [thread]
+    vector<uint16_t> rom_;
+    uint16_t keyboard_ = 0;
+    int stages_ = 1;
+    size_t nands_ = 0;
+    double balance_ = 1;
+    bool dirty_ = true, commit_ = false;
+    bool sampled_ = false;   // between tick and tock, like the built-in registers, state reads see the new value
+
+    uint8_t dff(uint32_t i) const { return sampled_ || commit_ ? next_[i] : v_[nl_.dffs[i].out]; }
+
+    void schedule() {
+        vector<uint32_t> order = nl_.order();
+        size_t nn = nl_.nands.size();
+        auto partOf = [&](uint32_t g) { return g < nn ? nl_.nandPart[g] : nl_.romPart[g - nn]; };
+
+        // Partitions to threads, largest first onto the least loaded thread.
+        vector<uint64_t> size(nl_.partitions, 0);
+        for (uint32_t p : nl_.nandPart) ++size[p];
+        vector<uint32_t> bySize(nl_.partitions);
+        iota(bySize.begin(), bySize.end(), 0);
+        stable_sort(bySize.begin(), bySize.end(), [&](uint32_t x, uint32_t y) { return size[x] > size[y]; });
+        vector<uint64_t> load(threads_, 0);
+        vector<int> owner(nl_.partitions, 0);
+        for (uint32_t p : bySize) {
+            int t = static_cast<int>(min_element(load.begin(), load.end()) - load.begin());
+            owner[p] = t;
+            load[t] += size[p];
+        }
+        balance_ = static_cast<double>(*max_element(load.begin(), load.end())) * threads_ / max<uint64_t>(1, nl_.nandPart.size());
+
+        // Stage of every driven net: +1 whenever a path crosses into another partition.
+        const uint32_t SOURCE = UINT32_MAX;
+        vector<uint32_t> stage(nl_.nets, 0), part(nl_.nets, SOURCE);
+        vector<uint32_t> gateStage(order.size());
+        for (uint32_t g : order) {
+            uint32_t p = partOf(g), s = 0;
+            auto input = [&](uint32_t net) {
+                if (part[net] != SOURCE) s = max(s, stage[net] + (part[net] != p));
+            };
+            if (g < nn) { input(nl_.nands[g].a); input(nl_.nands[g].b); }
+            else for (uint32_t a : nl_.roms[g - nn].address) input(a);
+            gateStage[g] = s;
+            stages_ = max<int>(stages_, s + 1);
+            if (g < nn) { stage[nl_.nands[g].out] = s; part[nl_.nands[g].out] = p; }
+            else for (uint32_t o : nl_.roms[g - nn].out) { stage[o] = s; part[o] = p; }
+        }
+        vector<uint32_t>().swap(stage);
+        vector<uint32_t>().swap(part);
+
+        // Bucket by (stage, partition) in level order, then lay each thread's partitions out per stage.
+        using Wide = hdl::Netlist::Nand;
+        vector<vector<vector<Wide>>> bucket(stages_, vector<vector<Wide>>(nl_.partitions));
+        for (uint32_t g : order) {
+            Wide x = g < nn ? nl_.nands[g] : Wide{ROM, g - static_cast<uint32_t>(nn), 0};
+            bucket[gateStage[g]][partOf(g)].push_back(x);
+        }
+        nands_ = nn;
+        vector<uint32_t>().swap(order);
+        vector<uint32_t>().swap(gateStage);
+        vector<hdl::Netlist::Nand>().swap(nl_.nands);
+        vector<uint32_t>().swap(nl_.nandPart);
+        vector<vector<vector<Wide>>> work(threads_, vector<vector<Wide>>(stages_));
+        for (int s = 0; s < stages_; ++s) {
+            for (uint32_t p = 0; p < nl_.partitions; ++p) {
+                auto& dst = work[owner[p]][s];
+                dst.insert(dst.end(), bucket[s][p].begin(), bucket[s][p].end());
+                vector<Wide>().swap(bucket[s][p]);
+            }
+        }
+
+        // Renumber: constants, then gate outputs in evaluation order, then everything else.
+        vector<uint32_t> id(nl_.nets, UINT32_MAX);
+        id[0] = 0, id[1] = 1;
+        uint32_t n = 2;
+        base_.assign(threads_, vector<uint32_t>(stages_));
+        for (int s = 0; s < stages_; ++s) {
+            for (int t = 0; t < threads_; ++t) {
+                base_[t][s] = n;
+                for (const Wide& g : work[t][s]) {
+                    if (g.a != ROM) id[g.out] = n;
+                    ++n;   // a ROM read's slot stays unused; its outputs are numbered below
+                }
+            }
+        }
+        for (uint32_t& x : id)
+            if (x == UINT32_MAX) x = n++;
+        auto map = [&](uint32_t& x) { x = id[x]; };
+        work_.assign(threads_, vector<vector<Gate>>(stages_));
+        for (int t = 0; t < threads_; ++t) {
+            for (int s = 0; s < stages_; ++s) {
+                work_[t][s].reserve(work[t][s].size());
+                for (const Wide& g : work[t][s]) work_[t][s].push_back(g.a == ROM ? Gate{ROM, g.b} : Gate{id[g.a], id[g.b]});
+                vector<Wide>().swap(work[t][s]);
+            }
+        }
+        for (auto& d : nl_.dffs) { map(d.in); map(d.out); }
+        for (auto& r : nl_.roms) { for (auto& x : r.address) map(x); for (auto& x : r.out) map(x); }
+        for (auto& k : nl_.keyboards) for (auto& x : k) map(x);
+        for (auto* ports : {&nl_.inputs, &nl_.outputs})
+            for (auto& p : *ports) for (auto& x : p.bits) map(x);
+        nl_.nets = n;
+        v_.assign(n, 0);
+        v_[1] = 1;
+
+        dffsOf_.assign(threads_, {});
+        for (uint32_t i = 0; i < nl_.dffs.size(); ++i) dffsOf_[owner[nl_.dffPart[i]]].push_back(i);
+        next_.assign(nl_.dffs.size(), 0);
+    }
+
+    void settle() {
+        if (!dirty_) return;
+        parallel(commit_ ? COMMIT_EVAL : EVAL);
+        dirty_ = commit_ = false;
+    }
+
+    void parallel(Job j) {
+        if (threads_ == 1) { run(0, j); return; }
+        job_.store(j, memory_order_relaxed);
+        barrier_.wait();
+        if (j == QUIT) return;
+        run(0, j);
+        barrier_.wait();
+    }
+
+    void worker(int t) {
+        while (true) {
+            barrier_.wait();
+            Job j = static_cast<Job>(job_.load(memory_order_relaxed));
+            if (j == QUIT) return;
+            run(t, j);
+            barrier_.wait();
+        }
+    }
+
+    void run(int t, Job j) {
+        uint8_t* v = v_.data();
+        if (j == SAMPLE) {
+            for (uint32_t i : dffsOf_[t]) next_[i] = v[nl_.dffs[i].in];
+            return;
+        }
+        if (j == COMMIT_EVAL) {
+            for (uint32_t i : dffsOf_[t]) v[nl_.dffs[i].out] = next_[i];
+            if (threads_ > 1) barrier_.wait();
+        }
+        for (int s = 0; s < stages_; ++s) {
+            uint8_t* out = v + base_[t][s];
+            for (const Gate& g : work_[t][s]) {
+                if (g.a != ROM) { *out++ = (v[g.a] & v[g.b]) ^ 1; continue; }
+                ++out;
+                const auto& r = nl_.roms[g.b];
+                uint32_t addr = 0;
+                for (size_t i = 0; i < r.address.size(); ++i) addr |= uint32_t(v[r.address[i]]) << i;
+                uint16_t word = rom_[addr & 0x7FFF];
+                for (size_t i = 0; i < r.out.size(); ++i) v[r.out[i]] = word >> i & 1;
+            }
+            if (threads_ > 1 && s + 1 < stages_) barrier_.wait();
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    int threads = 1;
+    string script;
+    set<string> split = {"RAM64", "RAM512", "RAM4K", "RAM16K", "Screen"};
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a.rfind("--threads=", 0) == 0) threads = max(1, stoi(a.substr(10)));
+        else if (a.rfind("--split=", 0) == 0) {
+            split.clear();
+            stringstream names(a.substr(8));
+            for (string n; getline(names, n, ',');) if (!n.empty()) split.insert(n);
+        }
+        else script = a;
+    }
+    if (script.empty()) {
+        cerr << "Usage: " << argv[0] << " [--threads=N] [--split=CHIP,...] <file.tst>" << endl;
+        return 1;
+    }
+
+    try {
+        string chip = hdl::scriptChip(script);
+        if (chip.empty()) throw runtime_error(script + ": no 'load Chip.hdl'");
+        auto t0 = chrono::steady_clock::now();
+        hdl::Library lib(hdl::searchPath(script));
+        GateSim sim(hdl::flatten(lib, chip, split), threads);
+        auto t1 = chrono::steady_clock::now();
+        hdl::Script tst(sim, script);
+        int bad = tst.run();
+        auto t2 = chrono::steady_clock::now();
+
+        double build = chrono::duration<double>(t1 - t0).count(), secs = chrono::duration<double>(t2 - t1).count();
+        cerr << chip << ": " << sim.nands() << " nands, " << sim.dffs() << " dffs, " << sim.partitions() << " partitions, "
+             << sim.stages() << " stages; built in " << fixed << setprecision(2) << build << " s\n"
+             << script << ": " << tst.cycles() << " cycles in " << setprecision(3) << secs << " s ("
+             << setprecision(1) << tst.cycles() / secs << " Hz, " << threads << " threads, load "
+             << setprecision(2) << sim.balance() << "x the mean on the busiest); "
+             << (bad ? to_string(bad) + " lines differ" : "comparison ended successfully") << "\n";
+        return bad ? 1 : 0;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
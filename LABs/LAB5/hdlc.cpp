@@ -0,0 +1,508 @@
+#include <bits/stdc++.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include "../hdl.h"
+using namespace std;
+
+// Compiles a LAB1-LAB5 chip to straight-line C++ and replays its .tst scripts
+// against the compiled code.
+//
+// The chip is flattened to Nand and DFF primitives (hdl.h), then simplified
+// without changing what any pin or register computes: constant inputs are
+// folded, Nands with the same two inputs are merged, Not(Not(x)) becomes x and
+// gates that reach no output, DFF or ROM address are dropped. Every net gets a
+// bit in a packed array of uint64_t words. Gates are taken level by level and
+// packed into words: gates of a level whose inputs come from one word at a
+// fixed shift (a bus, like the 16 Nands of a Not16) or from one bit of a word
+// (a broadcast select, like the sel of a Mux16) become one operation
+//
+//     const uint64_t v41 = ~((v7 >> 3) & (0 - (w[2] >> 16 & 1)));
+//
+// Words stay in locals of the generated function that computes them and are
+// stored to w[] only when something outside it reads them. The generated file
+// holds the net words and sampled DFF inputs in a State struct, plus three
+// extern "C" functions: hdlc_eval settles the combinational logic, hdlc_tick
+// samples the DFF inputs and hdlc_tock commits them. hdlc builds it with -O2
+// into a shared object, loads it and plays the scripts through hdl::Script, so
+// the outputs and compare files match those of gatesim and the nand2tetris
+// simulator.
+//
+// Build time grows with the chip: up to CPU it is under a second, RAM4K takes
+// minutes, and RAM16K, Memory and Computer are better left to gatesim.
+
+struct Loc { uint32_t word, bit; };
+
+class Compiler {
+public:
+    static constexpr int CHUNK = 2000;   // statements per generated function, to keep -O2 builds fast
+
+    explicit Compiler(const hdl::Netlist& nl) : nl_(nl) { compile(); }
+
+    Loc loc(uint32_t net) const { return loc_[canon_[net]]; }
+    uint32_t words() const { return words_; }
+    uint32_t dffBase() const { return dffBase_; }
+    uint32_t dffWords() const { return dffWords_; }
+    size_t gates() const { return gates_.size(); }
+    size_t ops() const { return items_.size(); }
+
+    string source(const string& chip) const {
+        ostringstream o;
+        o << "// " << chip << ".hdl compiled by hdlc: " << nl_.nands.size() << " Nand gates, " << gates_.size()
+          << " after simplification, in " << items_.size() << " word operations.\n"
+          << "// Bit b of net word i is w[i] >> b & 1. w[0] is 0 and w[1] is ~0.\n";
+        for (auto* ports : {&nl_.inputs, &nl_.outputs}) {
+            for (const auto& p : *ports) {
+                o << "// " << (ports == &nl_.inputs ? "in  " : "out ") << p.name << ":";
+                for (uint32_t net : p.bits) o << " " << loc(net).word << "." << loc(net).bit;
+                o << "\n";
+            }
+        }
+        if (!nl_.dffs.empty())
+            o << "// DFF i: bit i % 64 of w[" << dffBase_ << " + i / 64], sampled into next[i / 64] by hdlc_tick.\n";
+        o << "#include <cstdint>\n#include <cstring>\n\n"
+          << "struct State {\n"
+          << "    uint64_t w[" << words_ << "];\n"
+          << "    uint64_t next[" << max<uint32_t>(1, dffWords_) << "];\n"
+          << "};\n\n"
+          << "extern \"C\" const uint32_t hdlc_words = " << words_ << ", hdlc_dff_words = " << dffWords_ << ";\n";
+
+        size_t chunks = 0;
+        for (size_t i = 0; i < items_.size(); i += CHUNK, ++chunks) {
+            o << "\nstatic void eval" << chunks << "(uint64_t* __restrict w, const uint16_t* __restrict rom) {\n";
+            if (i == 0) o << "    (void)rom;\n";
+            for (size_t j = i; j < min(items_.size(), i + CHUNK); ++j) o << "    " << statement(items_[j], static_cast<int>(chunks)) << "\n";
+            o << "}\n";
+        }
+        o << "\nextern \"C\" void hdlc_eval(State* s, const uint16_t* rom) {\n";
+        for (size_t c = 0; c < chunks; ++c) o << "    eval" << c << "(s->w, rom);\n";
+        if (!chunks) o << "    (void)s, (void)rom;\n";
+        o << "}\n\nextern \"C\" void hdlc_tick(State* s) {\n    const uint64_t* w = s->w;\n    (void)w;\n";
+        for (uint32_t j = 0; j < dffWords_; ++j) {
+            vector<Loc> in;
+            for (uint32_t i = 64 * j; i < min<size_t>(nl_.dffs.size(), 64 * (j + 1)); ++i) in.push_back(loc(nl_.dffs[i].in));
+            o << "    s->next[" << j << "] = " << gather(in, -1) << ";\n";
+        }
+        o << "}\n\nextern \"C\" void hdlc_tock(State* s) {\n"
+          << "    memcpy(s->w + " << dffBase_ << ", s->next, sizeof(uint64_t) * " << dffWords_ << ");\n}\n";
+        return o.str();
+    }
+
+private:
+    // Where a group of gates reads one of its inputs: bit first of word, advancing
+    // with the output bit (SHIFT, a bus) or staying put (FIXED, a broadcast).
+    enum Mode { ONE, SHIFT, FIXED };   // ONE: a single gate so far, either will do
+    struct Src { uint32_t word; int first; Mode mode; };
+    // One emitted statement: a group of Nands packed into the used bits of word
+    // out, the first at bit k0, or a ROM32K read (rom >= 0) into bits 0-15.
+    struct Item { uint32_t out; int k0; uint64_t used; Src a, b; int rom = -1; };
+
+    const hdl::Netlist& nl_;
+    vector<uint32_t> canon_;
+    vector<Loc> loc_;
+    vector<hdl::Netlist::Nand> gates_;
+    vector<Item> items_;
+    vector<int> chunkOf_;      // per word: the generated function that computes it, -1 for sources
+    vector<uint8_t> escapes_;  // per word: read outside that function, so it is stored to w[]
+    uint32_t words_ = 2, dffBase_ = 0, dffWords_ = 0;
+
+    void compile() {
+        size_t nn = nl_.nands.size();
+        vector<uint32_t> order = nl_.order();
+        canon_.resize(nl_.nets);
+        iota(canon_.begin(), canon_.end(), 0);
+
+        // Simplify in topological order, tracking each net's new depth.
+        vector<uint32_t> level(nl_.nets, 0), notOf(nl_.nets, UINT32_MAX);
+        unordered_map<uint64_t, uint32_t> seen;
+        vector<uint32_t> prims;   // kept Nands as gates_ index, ROMs as nn + index
+        for (uint32_t g : order) {
+            if (g >= nn) {
+                uint32_t lv = 0;
+                for (uint32_t x : nl_.roms[g - nn].address) lv = max(lv, level[canon_[x]] + 1);
+                for (uint32_t x : nl_.roms[g - nn].out) level[x] = lv;
+                prims.push_back(g);
+                continue;
+            }
+            auto [a, b, out] = nl_.nands[g];
+            a = canon_[a], b = canon_[b];
+            if (a > b) swap(a, b);
+            if (a == 0) { canon_[out] = 1; continue; }
+            if (a == 1) a = b;   // Nand(1, b) is Not(b); Nand(1, 1) folds just below
+            if (a == 1) { canon_[out] = 0; continue; }
+            if (a == b && notOf[a] != UINT32_MAX) { canon_[out] = notOf[a]; continue; }
+            auto [it, fresh] = seen.emplace(uint64_t(a) << 32 | b, out);
+            if (!fresh) { canon_[out] = it->second; continue; }
+            if (a == b) notOf[out] = a;
+            level[out] = max(level[a], level[b]) + 1;
+            prims.push_back(static_cast<uint32_t>(gates_.size()) | (1u << 31));
+            gates_.push_back({a, b, out});
+        }
+        unordered_map<uint64_t, uint32_t>().swap(seen);
+
+        // Keep what an output, a DFF or a live ROM address depends on.
+        vector<uint8_t> live(nl_.nets, 0);
+        for (const auto& p : nl_.outputs) for (uint32_t x : p.bits) live[canon_[x]] = 1;
+        for (const auto& d : nl_.dffs) live[canon_[d.in]] = 1;
+        vector<uint8_t> keep(prims.size(), 0);
+        for (size_t i = prims.size(); i-- > 0;) {
+            uint32_t p = prims[i];
+            if (p >> 31) {
+                const auto& g = gates_[p & ~(1u << 31)];
+                if (!live[g.out]) continue;
+                live[g.a] = live[g.b] = keep[i] = 1;
+                continue;
+            }
+            const auto& r = nl_.roms[p - nn];
+            if (none_of(r.out.begin(), r.out.end(), [&](uint32_t x) { return live[x]; })) continue;
+            for (uint32_t x : r.address) live[canon_[x]] = 1;
+            keep[i] = 1;
+        }
+        vector<pair<uint32_t, uint32_t>> byLevel;   // (level, prim)
+        vector<hdl::Netlist::Nand> kept;
+        for (size_t i = 0; i < prims.size(); ++i) {
+            if (!keep[i]) continue;
+            uint32_t p = prims[i];
+            if (p >> 31) {
+                const auto& g = gates_[p & ~(1u << 31)];
+                byLevel.push_back({level[g.out], static_cast<uint32_t>(kept.size()) | (1u << 31)});
+                kept.push_back(g);
+            } else {
+                byLevel.push_back({level[nl_.roms[p - nn].out[0]], p});
+            }
+        }
+        gates_.swap(kept);
+        stable_sort(byLevel.begin(), byLevel.end(), [](auto& x, auto& y) { return x.first < y.first; });
+
+        // Sources first: constants, input ports, keyboards, DFFs.
+        loc_.assign(nl_.nets, Loc{0, 0});
+        loc_[1] = {1, 0};
+        for (const auto& p : nl_.inputs) {
+            for (size_t i = 0; i < p.bits.size(); ++i) loc_[p.bits[i]] = {words_ + static_cast<uint32_t>(i / 64), static_cast<uint32_t>(i % 64)};
+            words_ += static_cast<uint32_t>((p.bits.size() + 63) / 64);
+        }
+        for (const auto& k : nl_.keyboards) {
+            for (size_t i = 0; i < k.size(); ++i) loc_[k[i]] = {words_, static_cast<uint32_t>(i)};
+            ++words_;
+        }
+        dffBase_ = words_;
+        dffWords_ = static_cast<uint32_t>((nl_.dffs.size() + 63) / 64);
+        for (size_t i = 0; i < nl_.dffs.size(); ++i) loc_[nl_.dffs[i].out] = {dffBase_ + static_cast<uint32_t>(i / 64), static_cast<uint32_t>(i % 64)};
+        words_ += dffWords_;
+
+        // Pack each level's gates into words, trying the most recently opened groups first.
+        const size_t WINDOW = 32;
+        vector<size_t> open;
+        uint32_t current = UINT32_MAX;
+        for (auto [lv, p] : byLevel) {
+            if (lv != current) { open.clear(); current = lv; }
+            if (!(p >> 31)) {
+                const auto& r = nl_.roms[p - nn];
+                Item it{words_++, 0, 0xFFFF, {}, {}, static_cast<int>(p - nn)};
+                for (size_t i = 0; i < r.out.size(); ++i) loc_[r.out[i]] = {it.out, static_cast<uint32_t>(i)};
+                items_.push_back(it);
+                continue;
+            }
+            const auto& g = gates_[p & ~(1u << 31)];
+            Loc la = loc_[g.a], lb = loc_[g.b];
+            int k = -1;
+            for (size_t i = open.size(); i-- > 0 && open.size() - i <= WINDOW && k < 0;) {
+                Item& it = items_[open[i]];
+                k = place(it, la, lb);
+                if (k < 0 && g.a != g.b) k = place(it, lb, la);
+                if (k < 0) continue;
+                loc_[g.out] = {it.out, static_cast<uint32_t>(k)};
+                if (it.used == ~0ull) open.erase(open.begin() + static_cast<ptrdiff_t>(i));
+            }
+            if (k >= 0) continue;
+            Item it{words_++, static_cast<int>(la.bit), 1ull << la.bit,
+                    {la.word, static_cast<int>(la.bit), ONE}, {lb.word, static_cast<int>(lb.bit), ONE}};
+            loc_[g.out] = {it.out, la.bit};
+            open.push_back(items_.size());
+            items_.push_back(it);
+        }
+
+        // Split into functions; words used only inside their own function stay in locals.
+        chunkOf_.assign(words_, -1);
+        escapes_.assign(words_, 0);
+        for (size_t i = 0; i < items_.size(); ++i) chunkOf_[items_[i].out] = static_cast<int>(i / CHUNK);
+        auto use = [&](uint32_t w, int chunk) { if (chunkOf_[w] != chunk) escapes_[w] = 1; };
+        for (size_t i = 0; i < items_.size(); ++i) {
+            int chunk = static_cast<int>(i / CHUNK);
+            if (items_[i].rom < 0) { use(items_[i].a.word, chunk); use(items_[i].b.word, chunk); continue; }
+            for (uint32_t x : nl_.roms[items_[i].rom].address) use(loc(x).word, chunk);
+        }
+        for (const auto& p : nl_.outputs) for (uint32_t x : p.bits) escapes_[loc(x).word] = 1;
+        for (const auto& d : nl_.dffs) escapes_[loc(d.in).word] = 1;
+    }
+
+    // Puts a gate reading la and lb into a free bit of group it; returns the bit, or -1.
+    static int place(Item& it, Loc la, Loc lb) {
+        if (it.rom >= 0 || la.word != it.a.word || lb.word != it.b.word) return -1;
+        auto shiftTo = [&](const Src& s, Loc l) { return s.mode == FIXED ? -1 : static_cast<int>(l.bit) - (s.first - it.k0); };
+        for (int k : {shiftTo(it.a, la), shiftTo(it.b, lb), __builtin_ctzll(~it.used)}) {
+            if (k < 0 || k >= 64 || (it.used >> k & 1)) continue;
+            Mode ma, mb;
+            if (!fits(it, it.a, la, k, ma) || !fits(it, it.b, lb, k, mb)) continue;
+            it.a.mode = ma, it.b.mode = mb;
+            it.used |= 1ull << k;
+            return k;
+        }
+        return -1;
+    }
+    static bool fits(const Item& it, const Src& s, Loc l, int k, Mode& mode) {
+        bool shift = static_cast<int>(l.bit) == s.first + (k - it.k0), fixed = static_cast<int>(l.bit) == s.first;
+        if (s.mode != FIXED && shift) { mode = SHIFT; return true; }
+        if (s.mode != SHIFT && fixed) { mode = FIXED; return true; }
+        return false;
+    }
+
+    // Word w as read from generated function chunk (-1: outside eval).
+    string word(uint32_t w, int chunk) const {
+        return chunkOf_[w] == chunk && chunk >= 0 ? "v" + to_string(w) : "w[" + to_string(w) + "]";
+    }
+
+    string read(const Src& s, int k0, int chunk) const {
+        if (s.mode == FIXED) return "(0 - (" + word(s.word, chunk) + " >> " + to_string(s.first) + " & 1))";
+        int d = s.first - k0;
+        if (d > 0) return "(" + word(s.word, chunk) + " >> " + to_string(d) + ")";
+        if (d < 0) return "(" + word(s.word, chunk) + " << " + to_string(-d) + ")";
+        return word(s.word, chunk);
+    }
+
+    // An expression whose bit t is the net at in[t].
+    string gather(const vector<Loc>& in, int chunk) const {
+        string e;
+        for (size_t t = 0; t < in.size();) {
+            size_t end = t + 1;
+            int d = static_cast<int>(in[t].bit) - static_cast<int>(t);
+            auto same = [&](size_t u) {
+                return in[u].word == in[t].word && (in[t].word < 2 || static_cast<int>(in[u].bit) - static_cast<int>(u) == d);
+            };
+            while (end < in.size() && same(end)) ++end;
+            uint64_t mask = (end - t == 64 ? ~0ull : ((1ull << (end - t)) - 1)) << t;
+            char m[32];
+            snprintf(m, sizeof m, "0x%llxull", static_cast<unsigned long long>(mask));
+            string term;
+            if (in[t].word == 1) term = m;
+            else if (in[t].word != 0) {
+                string w = word(in[t].word, chunk);
+                if (d > 0) w = "(" + w + " >> " + to_string(d) + ")";
+                if (d < 0) w = "(" + w + " << " + to_string(-d) + ")";
+                term = mask == ~0ull ? w : "(" + w + " & " + m + ")";
+            }
+            if (!term.empty()) e += (e.empty() ? "" : " | ") + term;
+            t = end;
+        }
+        return e.empty() ? "0" : e;
+    }
+
+    string statement(const Item& it, int chunk) const {
+        string e;
+        if (it.rom >= 0) {
+            vector<Loc> addr;
+            for (uint32_t x : nl_.roms[it.rom].address) addr.push_back(loc(x));
+            e = "rom[(" + gather(addr, chunk) + ") & 0x7FFF]";
+        } else {
+            string a = read(it.a, it.k0, chunk), b = read(it.b, it.k0, chunk);
+            e = a == b ? "~" + a : "~(" + a + " & " + b + ")";
+        }
+        string v = word(it.out, chunk);
+        return "const uint64_t " + v + " = " + e + ";" + (escapes_[it.out] ? " w[" + to_string(it.out) + "] = " + v + ";" : "");
+    }
+};
+
+// Runs the compiled chip for hdl::Script, with the built-in register timing of gatesim.
+class CompiledSim : public hdl::Target {
+public:
+    using Eval = void (*)(uint64_t*, const uint16_t*);
+    using Step = void (*)(uint64_t*);
+
+    CompiledSim(const hdl::Netlist& nl, const Compiler& c, void* so) : nl_(nl), c_(c) {
+        eval_ = reinterpret_cast<Eval>(dlsym(so, "hdlc_eval"));
+        tick_ = reinterpret_cast<Step>(dlsym(so, "hdlc_tick"));
+        tock_ = reinterpret_cast<Step>(dlsym(so, "hdlc_tock"));
+        auto* words = static_cast<const uint32_t*>(dlsym(so, "hdlc_words"));
+        if (!eval_ || !tick_ || !tock_ || !words || *words != c.words()) throw runtime_error("compiled chip does not match its netlist");
+        rom_.assign(32768, 0);
+        reset();
+    }
+
+    uint64_t evals() const { return evals_; }
+
+    // Back to power-on: every net and register 0.
+    void reset() {
+        state_.assign(c_.words() + max<uint32_t>(1, c_.dffWords()), 0);
+        state_[1] = ~0ull;
+        keyboard_ = 0;
+        dirty_ = true;
+        commit_ = sampled_ = false;
+    }
+
+    int width(const string& pin) override {
+        const hdl::Netlist::Port* p = nl_.port(pin);
+        return p ? static_cast<int>(p->bits.size()) : -1;
+    }
+    void set(const string& pin, uint64_t value) override {
+        for (const auto& p : nl_.inputs) {
+            if (p.name != pin) continue;
+            if (p.bits.size() < 64) state_[c_.loc(p.bits[0]).word] = value & ((1ull << p.bits.size()) - 1);   // a port has its own word from bit 0
+            else for (size_t i = 0; i < p.bits.size(); ++i) put(c_.loc(p.bits[i]), value >> i & 1);
+            dirty_ = true;
+            return;
+        }
+        throw runtime_error("cannot set output pin " + pin);
+    }
+    uint64_t get(const string& pin) override {
+        settle();
+        uint64_t x = 0;
+        const auto& bits = nl_.port(pin)->bits;
+        for (size_t i = 0; i < bits.size(); ++i) x |= bit(c_.loc(bits[i])) << i;
+        return x;
+    }
+    bool getState(const string& chip, int index, uint64_t& value) override {
+        settle();
+        if (chip == "ROM32K") { if (index < 0 || index >= 32768) return false; value = rom_[index]; return true; }
+        if (chip == "Keyboard") { value = keyboard_; return !nl_.keyboards.empty(); }
+        uint32_t first;
+        if (!nl_.word(chip, index, first)) return false;
+        value = 0;
+        for (uint32_t b = 0; b < 16 && first + b < nl_.dffs.size(); ++b) value |= dff(first + b) << b;
+        return true;
+    }
+    bool setState(const string& chip, int index, uint64_t value) override {
+        settle();
+        if (chip == "ROM32K") { if (index < 0 || index >= 32768) return false; rom_[index] = value; dirty_ = true; return true; }
+        if (chip == "Keyboard") {
+            keyboard_ = static_cast<uint16_t>(value);
+            for (const auto& k : nl_.keyboards)
+                for (int b = 0; b < 16; ++b) put(c_.loc(k[b]), value >> b & 1);
+            dirty_ = true;
+            return !nl_.keyboards.empty();
+        }
+        uint32_t first;
+        if (!nl_.word(chip, index, first)) return false;
+        for (uint32_t b = 0; b < 16 && first + b < nl_.dffs.size(); ++b) {
+            uint32_t i = first + b;
+            put({c_.dffBase() + i / 64, i % 64}, value >> b & 1);
+            put({c_.words() + i / 64, i % 64}, value >> b & 1);
+        }
+        dirty_ = true;
+        return true;
+    }
+    bool loadRom(const string& file) override {
+        if (!hdl::loadHack(file, rom_)) return false;
+        dirty_ = true;
+        return true;
+    }
+    void eval() override { dirty_ = true; settle(); }
+    void tick() override { settle(); tick_(state_.data()); sampled_ = true; }
+    void tock() override { commit_ = dirty_ = true; sampled_ = false; }
+
+private:
+    const hdl::Netlist& nl_;
+    const Compiler& c_;
+    Eval eval_;
+    Step tick_, tock_;
+    vector<uint64_t> state_;   // the generated State: net words, then sampled DFF inputs
+    vector<uint16_t> rom_;
+    uint16_t keyboard_ = 0;
+    uint64_t evals_ = 0;
+    bool dirty_ = true, commit_ = false;
+    bool sampled_ = false;   // between tick and tock, like the built-in registers, state reads see the new value
+
+    uint64_t bit(Loc l) const { return state_[l.word] >> l.bit & 1; }
+    void put(Loc l, uint64_t v) { state_[l.word] = (state_[l.word] & ~(1ull << l.bit)) | v << l.bit; }
+    uint64_t dff(uint32_t i) const {
+        Loc l{(sampled_ || commit_ ? c_.words() : c_.dffBase()) + i / 64, i % 64};
+        return bit(l);
+    }
+
+    void settle() {
+        if (!dirty_) return;
+        if (commit_) tock_(state_.data());
+        eval_(state_.data(), rom_.data());
+        ++evals_;
+        dirty_ = commit_ = false;
+    }
+};
+
+// Builds chip's generated source in dir into a shared object and loads it.
+static void* build(const string& cxx, const string& dir, const string& chip, const string& source) {
+    string cpp = dir + "/" + chip + ".cpp", so = dir + "/" + chip + ".so";
+    ofstream(cpp) << source;
+    string cmd = cxx + " -O2 -std=c++17 -shared -fPIC -o '" + so + "' '" + cpp + "'";
+    if (system(cmd.c_str()) != 0) throw runtime_error("failed: " + cmd);
+    void* h = dlopen(so.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!h) throw runtime_error(dlerror());
+    return h;
+}
+
+int main(int argc, char* argv[]) {
+    const char* env = getenv("CXX");
+    string cxx = env && *env ? env : "c++", out;
+    int repeat = 1;
+    vector<string> scripts;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a.rfind("--cxx=", 0) == 0) cxx = a.substr(6);
+        else if (a.rfind("--out=", 0) == 0) out = a.substr(6);
+        else if (a.rfind("--repeat=", 0) == 0) repeat = max(1, stoi(a.substr(9)));
+        else scripts.push_back(a);
+    }
+    if (scripts.empty()) {
+        cerr << "Usage: " << argv[0] << " [--out=DIR] [--cxx=COMPILER] [--repeat=N] <file.tst>..." << endl;
+        return 1;
+    }
+
+    // Generated files go to --out (and stay there) or to a scratch directory.
+    string dir = out;
+    if (dir.empty()) {
+        char tmp[] = "/tmp/hdlcXXXXXX";
+        if (!mkdtemp(tmp)) { perror("mkdtemp"); return 1; }
+        dir = tmp;
+    }
+    int failed = 0;
+    for (const string& script : scripts) {
+        try {
+            string chip = hdl::scriptChip(script);
+            if (chip.empty()) throw runtime_error(script + ": no 'load Chip.hdl'");
+            auto t0 = chrono::steady_clock::now();
+            hdl::Library lib(hdl::searchPath(script));
+            hdl::Netlist nl = hdl::flatten(lib, chip);
+            Compiler c(nl);
+            void* so = build(cxx, dir, chip, c.source(chip));
+            auto t1 = chrono::steady_clock::now();
+            CompiledSim sim(nl, c, so);
+            int bad = 0;
+            uint64_t cycles = 0;
+            for (int r = 0; r < repeat; ++r) {
+                if (r) sim.reset();
+                hdl::Script tst(sim, script);
+                bad = tst.run();
+                cycles += tst.cycles();
+            }
+            auto t2 = chrono::steady_clock::now();
+
+            double compile = chrono::duration<double>(t1 - t0).count(), secs = chrono::duration<double>(t2 - t1).count();
+            cerr << chip << ": " << nl.nands.size() << " nands -> " << c.gates() << " after simplification, " << c.ops()
+                 << " word ops, " << nl.dffs.size() << " dffs; compiled in " << fixed << setprecision(2) << compile << " s\n"
+                 << script << ": " << repeat << (repeat == 1 ? " run, " : " runs, ") << cycles << " cycles, " << sim.evals()
+                 << " evaluations in " << setprecision(3) << secs << " s (" << setprecision(0) << sim.evals() / secs
+                 << " evaluations/s); " << (bad ? to_string(bad) + " lines differ" : "comparison ended successfully") << "\n";
+            if (bad) ++failed;
+            dlclose(so);
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            ++failed;
+        }
+    }
+    if (out.empty()) {
+        for (const string& s : scripts) {
+            string chip = hdl::scriptChip(s);
+            unlink((dir + "/" + chip + ".cpp").c_str());
+            unlink((dir + "/" + chip + ".so").c_str());
+        }
+        rmdir(dir.c_str());
+    }
+    return failed ? 1 : 0;
+}
@@ -6,6 +6,7 @@
 #include <bitset>
 #include <algorithm>
 #include <cctype> 
+#include "../stats.h"
 using namespace std;
 
 map<string, string> dest_map = {
@@ -23,7 +24,10 @@ map<string, string> comp_map = {
     {"M",   "1110000"}, {"!M",  "1110001"}, {"-M",  "1110011"},
     {"M+1", "1110111"}, {"M-1", "1110010"}, {"D+M", "1000010"},
     {"D-M", "1010011"}, {"M-D", "1000111"}, {"D&M", "1000000"},
-    {"D|M", "1010101"}
+    {"D|M", "1010101"},
+    // operand-swapped spellings of the commutative computations, as the VM translator writes them
+    {"A+D", "0000010"}, {"A&D", "0000000"}, {"A|D", "0010101"},
+    {"M+D", "1000010"}, {"M&D", "1000000"}, {"M|D", "1010101"}
 };
 
 map<string, string> jump_map = {
@@ -123,33 +127,47 @@ string parse_C_instruction(const string& line) {
 // --- Main Execution ---
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <input_file.asm>" << endl;
+    Stats& stats = Stats::get();
+    string import_file;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (stats.parseFlag(arg, "assembler")) continue;
+        if (!import_file.empty()) { import_file.clear(); break; }
+        import_file = arg;
+    }
+    if (import_file.empty()) {
+        cerr << "Usage: " << argv[0] << " [--stats[=text|json][:file]] <input_file.asm>" << endl;
         return 1;
     }
 
-    string import_file = argv[1];
     cout << "Assembler running on file " << import_file << endl;
     
     ifstream infile;
     string line;
+    long long bytes_in = 0, lines = 0;
 
     // --- Pass 1: Build Label Symbol Table ---
     // Scans for (LABEL) declarations and adds them to the symbol table.
-    int program_position = 0;
+    int program_position = 0, labels = 0;
     infile.open(import_file);
     if (!infile.is_open()) {
         cerr << "Error: Could not open file " << import_file << endl;
         return 1;
     }
-    while (getline(infile, line)) {
-        string cleaned = clean_line(line);
-        if (cleaned.empty()) continue;
-        if (cleaned[0] == '(') {
-            string label = cleaned.substr(1, cleaned.length() - 2);
-            symbols[label] = program_position;
-        } else {
-            program_position++;
+    {
+        auto timer = stats.time("pass1");
+        while (getline(infile, line)) {
+            bytes_in += line.size() + 1;
+            ++lines;
+            string cleaned = clean_line(line);
+            if (cleaned.empty()) continue;
+            if (cleaned[0] == '(') {
+                string label = cleaned.substr(1, cleaned.length() - 2);
+                symbols[label] = program_position;
+                ++labels;
+            } else {
+                program_position++;
+            }
         }
     }
     infile.close();
@@ -165,34 +183,45 @@ int main(int argc, char* argv[]) {
     }
 
     int start_memory = 16; // RAM addresses for new variables start at 16
-    while (getline(infile, line)) {
-        string cleaned = clean_line(line);
-        if (cleaned.empty() || cleaned[0] == '(') {
-            continue;
-        }
-        string binary_line;
-        if (cleaned[0] == '@') {
-            // A-Instruction
-            string symbol = cleaned.substr(1);
-            if (!is_number(symbol)) {
-                // If it's a symbol, check if it's already in the table
-                if (symbols.find(symbol) == symbols.end()) {
-                    // If not, it's a new variable. Add it.
-                    symbols[symbol] = start_memory;
-                    start_memory++;
+    {
+        auto timer = stats.time("pass2");
+        while (getline(infile, line)) {
+            string cleaned = clean_line(line);
+            if (cleaned.empty() || cleaned[0] == '(') {
+                continue;
+            }
+            string binary_line;
+            if (cleaned[0] == '@') {
+                // A-Instruction
+                string symbol = cleaned.substr(1);
+                if (!is_number(symbol)) {
+                    // If it's a symbol, check if it's already in the table
+                    if (symbols.find(symbol) == symbols.end()) {
+                        // If not, it's a new variable. Add it.
+                        symbols[symbol] = start_memory;
+                        start_memory++;
+                    }
                 }
+                binary_line = parse_A_instruction(symbol);
+            } else {
+                // C-Instruction
+                binary_line = parse_C_instruction(cleaned);
             }
-            binary_line = parse_A_instruction(symbol);
-        } else {
-            // C-Instruction
-            binary_line = parse_C_instruction(cleaned);
+            outfile << binary_line << '\n';
         }
-        outfile << binary_line << '\n';
+        infile.close();
+        outfile.close();
     }
-    infile.close();
-    outfile.close();
+
+    stats.add("bytes_in", bytes_in);
+    stats.add("lines", lines);
+    stats.add("instructions", program_position);
+    stats.add("bytes_out", 17LL * program_position);
+    stats.add("labels", labels);
+    stats.add("variables", start_memory - 16);
+    stats.add("symbols", symbols.size());
 
     cout << "Assembler completed successfully: output is " << output_file << endl;
 
     return 0;
-}
\ No newline at end of file
+}
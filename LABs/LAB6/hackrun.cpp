@@ -0,0 +1,679 @@
+#include <bits/stdc++.h>
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define HACK_JIT 1
+#endif
+using namespace std;
+
+// Runs a .hack ROM on a software Hack computer: ROM and RAM of 32K words each,
+// the screen at 16384 and the keyboard at 24576. On x86-64 Linux, basic blocks
+// are compiled to machine code on first execution; --interp (or any other host)
+// uses the predecoded interpreter instead. A run ends when the PC reaches a
+// jump-to-self loop (the translators' END / Sys.halt idiom) or leaves the ROM,
+// or after --max-cycles instructions.
+//
+// --hle replaces Jack OS routines with native code (see Hle below); both
+// engines stop at a hooked entry (K_HOOK) and leave it to the driver loop.
+
+enum Kind : uint8_t { K_A, K_C, K_HALT, K_HOOK };
+
+// One ROM word, decoded once. comp holds the six ALU control bits (zx nx zy ny f no).
+struct Decoded {
+    Kind kind = K_HALT;
+    bool useM = false;
+    uint8_t comp = 0;
+    uint8_t dest = 0;       // A=4, D=2, M=1
+    uint8_t jump = 0;
+    uint16_t value = 0;
+};
+
+struct Machine {
+    vector<Decoded> code = vector<Decoded>(32768);  // past the end of the ROM: K_HALT
+    vector<Decoded> rom;                            // code without hooks
+    vector<uint16_t> ram = vector<uint16_t>(32768);
+    uint16_t A = 0, D = 0, pc = 0;
+    uint64_t cycles = 0;
+    size_t romSize = 0;
+
+    void load(const string& file) {
+        ifstream in(file);
+        if (!in) throw runtime_error("cannot open " + file);
+        string line;
+        while (getline(in, line)) {
+            while (!line.empty() && isspace(static_cast<unsigned char>(line.back()))) line.pop_back();
+            if (line.empty()) continue;
+            if (line.size() != 16 || line.find_first_not_of("01") != string::npos)
+                throw runtime_error(file + ":" + to_string(romSize + 1) + ": not a 16-bit binary word");
+            if (romSize == code.size()) throw runtime_error(file + ": more than 32768 instructions");
+            uint16_t w = static_cast<uint16_t>(stoul(line, nullptr, 2));
+            Decoded& d = code[romSize++];
+            if (!(w & 0x8000)) { d.kind = K_A; d.value = w; continue; }
+            d.kind = K_C;
+            d.useM = w >> 12 & 1;
+            d.comp = w >> 6 & 63;
+            d.dest = w >> 3 & 7;
+            d.jump = w & 7;
+        }
+        // "@X / 0;JMP" at X, with nothing written, spins forever: treat it as a halt.
+        for (size_t i = 0; i + 1 < romSize; ++i) {
+            const Decoded& a = code[i];
+            const Decoded& c = code[i + 1];
+            if (a.kind == K_A && a.value == i && c.kind == K_C && c.dest == 0 && c.jump == 7) code[i].kind = K_HALT;
+        }
+        rom = code;
+    }
+
+    bool halted() const { return code[pc].kind == K_HALT; }
+    bool atHook() const { return code[pc].kind == K_HOOK; }
+};
+
+static inline uint16_t alu(uint8_t comp, uint16_t x, uint16_t y) {
+    switch (comp) {
+        case 0b101010: return 0;
+        case 0b111111: return 1;
+        case 0b111010: return 0xFFFF;
+        case 0b001100: return x;
+        case 0b110000: return y;
+        case 0b001101: return ~x;
+        case 0b110001: return ~y;
+        case 0b001111: return -x;
+        case 0b110011: return -y;
+        case 0b011111: return x + 1;
+        case 0b110111: return y + 1;
+        case 0b001110: return x - 1;
+        case 0b110010: return y - 1;
+        case 0b000010: return x + y;
+        case 0b010011: return x - y;
+        case 0b000111: return y - x;
+        case 0b000000: return x & y;
+        case 0b010101: return x | y;
+    }
+    if (comp & 32) x = 0;
+    if (comp & 16) x = ~x;
+    if (comp & 8) y = 0;
+    if (comp & 4) y = ~y;
+    uint16_t o = (comp & 2) ? x + y : x & y;
+    return (comp & 1) ? ~o : o;
+}
+
+static inline bool jumps(uint8_t j, int16_t o) {
+    return ((j & 4) && o < 0) || ((j & 2) && o == 0) || ((j & 1) && o > 0);
+}
+
+// Runs instructions one at a time until a halt, a hook or until cycles reaches
+// limit. With hooks false it runs the plain ROM and only stops at halts.
+static void interpret(Machine& m, uint64_t limit, bool hooks = true) {
+    const Decoded* code = hooks ? m.code.data() : m.rom.data();
+    uint16_t* ram = m.ram.data();
+    uint16_t A = m.A, D = m.D, pc = m.pc;
+    uint64_t cycles = m.cycles;
+    while (cycles < limit) {
+        const Decoded& d = code[pc];
+        if (d.kind >= K_HALT) break;
+        ++cycles;
+        if (d.kind == K_A) { A = d.value; pc = (pc + 1) & 0x7FFF; continue; }
+        uint16_t o = alu(d.comp, D, d.useM ? ram[A & 0x7FFF] : A);
+        uint16_t oldA = A;
+        if (d.dest & 1) ram[oldA & 0x7FFF] = o;
+        if (d.dest & 4) A = o;
+        if (d.dest & 2) D = o;
+        pc = (d.jump && jumps(d.jump, static_cast<int16_t>(o)) ? oldA : pc + 1) & 0x7FFF;
+    }
+    m.A = A; m.D = D; m.pc = pc; m.cycles = cycles;
+}
+
+#ifdef HACK_JIT
+
+// Just enough of an x86-64 encoder for the code below: 32-bit ALU ops between
+// registers, 16-bit loads/stores at [base + index*scale + disp], rel32 jumps.
+enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15, NOREG = -1 };
+
+struct X64 {
+    uint8_t* p;
+
+    void b(uint8_t v) { *p++ = v; }
+    void d32(int32_t v) { memcpy(p, &v, 4); p += 4; }
+    void rex(bool w, int reg, int index, int base) {
+        uint8_t r = 0x40 | (w ? 8 : 0) | (reg & 8 ? 4 : 0) | (index >= 0 && index & 8 ? 2 : 0) | (base & 8 ? 1 : 0);
+        if (r != 0x40) b(r);
+    }
+    void mem(int reg, int base, int index, int scale, int32_t disp) {
+        int mod = disp == 0 && (base & 7) != RBP ? 0 : disp >= -128 && disp <= 127 ? 1 : 2;
+        if (index < 0 && (base & 7) != RSP) {
+            b(mod << 6 | (reg & 7) << 3 | (base & 7));
+        } else {
+            int ss = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+            b(mod << 6 | (reg & 7) << 3 | 4);
+            b(ss << 6 | (index < 0 ? 4 : index & 7) << 3 | (base & 7));
+        }
+        if (mod == 1) b(static_cast<uint8_t>(disp));
+        else if (mod == 2) d32(disp);
+    }
+    // op r/m, r (0x89 mov, 0x01 add, 0x29 sub, 0x21 and, 0x09 or, 0x31 xor, 0x39 cmp, 0x85 test)
+    void rr(uint8_t op, int dst, int src, bool w = false) {
+        rex(w, src, NOREG, dst);
+        b(op);
+        b(0xC0 | (src & 7) << 3 | (dst & 7));
+    }
+    void movImm(int r, uint32_t v) { rex(false, 0, NOREG, r); b(0xB8 + (r & 7)); d32(static_cast<int32_t>(v)); }
+    // 0 add, 1 or, 4 and, 5 sub, 7 cmp
+    void aluImm(int ext, int r, int32_t v) { rex(false, 0, NOREG, r); b(0x81); b(0xC0 | ext << 3 | (r & 7)); d32(v); }
+    void notR(int r) { rex(false, 0, NOREG, r); b(0xF7); b(0xD0 | (r & 7)); }
+    void negR(int r) { rex(false, 0, NOREG, r); b(0xF7); b(0xD8 | (r & 7)); }
+    void zext16(int dst, int src) { rex(false, dst, NOREG, src); b(0x0F); b(0xB7); b(0xC0 | (dst & 7) << 3 | (src & 7)); }
+    void loadW(int r, int base, int index, int scale, int32_t disp) {
+        rex(false, r, index, base); b(0x0F); b(0xB7); mem(r, base, index, scale, disp);
+    }
+    void storeW(int r, int base, int index, int scale, int32_t disp) {
+        b(0x66); rex(false, r, index, base); b(0x89); mem(r, base, index, scale, disp);
+    }
+    void load(bool w, int r, int base, int32_t disp) { rex(w, r, NOREG, base); b(0x8B); mem(r, base, NOREG, 1, disp); }
+    void store(bool w, int r, int base, int32_t disp) { rex(w, r, NOREG, base); b(0x89); mem(r, base, NOREG, 1, disp); }
+    void push(int r) { if (r & 8) b(0x41); b(0x50 + (r & 7)); }
+    void pop(int r) { if (r & 8) b(0x41); b(0x58 + (r & 7)); }
+    void jmpR(int r) { rex(false, 0, NOREG, r); b(0xFF); b(0xE0 | (r & 7)); }
+    // rel32 jumps return the address of their displacement for patch()
+    uint8_t* jmp(const uint8_t* to = nullptr) { b(0xE9); uint8_t* at = p; d32(0); if (to) patch(at, to); return at; }
+    uint8_t* jcc(uint8_t cc, const uint8_t* to = nullptr) { b(0x0F); b(cc); uint8_t* at = p; d32(0); if (to) patch(at, to); return at; }
+    static void patch(uint8_t* at, const uint8_t* to) {
+        int32_t rel = static_cast<int32_t>(to - (at + 4));
+        memcpy(at, &rel, 4);
+    }
+};
+
+// Basic-block compiler. A, D and the cycle counter live in r12d, r13d and r14
+// across blocks; rbx points at RAM and rbp at the block table. A block ends at
+// its first jumping instruction. Direct jumps (the target was set by an @ in the
+// same block) are chained straight to the target block once it exists; jumps
+// through a computed A, like the VM return sequence, look the target up in the
+// table. ROM is read-only, so code is only discarded when the buffer fills.
+class Jit {
+public:
+    explicit Jit(Machine& m) : m_(m), table_(32768), len_(32768), pending_(32768) {
+        buf_ = static_cast<uint8_t*>(mmap(nullptr, kBuffer, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (buf_ == MAP_FAILED) throw runtime_error("cannot map JIT buffer");
+        emitRuntime();
+    }
+    ~Jit() { munmap(buf_, kBuffer); }
+
+    void run(uint64_t limit) {
+        State st{m_.ram.data(), table_.data(), m_.cycles, limit, m_.A, m_.D};
+        uint32_t pc = m_.pc;
+        while (st.cycles < limit && m_.code[pc].kind < K_HALT) {
+            if (!table_[pc]) compile(pc);
+            if (st.cycles + len_[pc] > limit) break;   // the interpreter finishes the last partial block
+            pc = enter_(&st, table_[pc]);
+            ++exits_;
+        }
+        m_.A = static_cast<uint16_t>(st.A);
+        m_.D = static_cast<uint16_t>(st.D);
+        m_.cycles = st.cycles;
+        m_.pc = static_cast<uint16_t>(pc);
+        interpret(m_, limit);
+    }
+
+    size_t blocks() const { return blocks_; }
+    size_t codeBytes() const { return static_cast<size_t>(p_ - buf_); }
+    size_t exits() const { return exits_; }
+
+private:
+    struct State {
+        uint16_t* ram;
+        uint8_t** table;
+        uint64_t cycles;
+        uint64_t limit;
+        uint32_t A, D;
+    };
+    static_assert(offsetof(State, cycles) == 16 && offsetof(State, limit) == 24 &&
+                  offsetof(State, A) == 32 && offsetof(State, D) == 36, "offsets used by the trampoline");
+
+    static constexpr size_t kBuffer = 64 << 20;
+    static constexpr uint32_t kMaxBlock = 1024;
+    static constexpr size_t kMaxBlockBytes = kMaxBlock * 64 + 256;
+
+    Machine& m_;
+    uint8_t* buf_ = nullptr;
+    uint8_t* p_ = nullptr;
+    uint8_t* runtimeEnd_ = nullptr;
+    uint8_t* exit_ = nullptr;        // eax = next PC; saves state and returns it
+    uint8_t* indirect_ = nullptr;    // eax = target PC; table hit or exit
+    uint32_t (*enter_)(State*, uint8_t*) = nullptr;
+    vector<uint8_t*> table_;         // block entry by PC
+    vector<uint32_t> len_;           // instructions in the block at PC
+    vector<vector<uint8_t*>> pending_;  // exit stubs waiting for the block at PC
+    size_t blocks_ = 0, exits_ = 0;
+
+    void emitRuntime() {
+        X64 x{buf_};
+        enter_ = reinterpret_cast<uint32_t (*)(State*, uint8_t*)>(x.p);
+        for (int r : {RBX, RBP, R12, R13, R14, R15}) x.push(r);
+        x.b(0x48); x.b(0x83); x.b(0xEC); x.b(0x08);          // sub rsp, 8 (keeps rsp 16-aligned)
+        x.store(true, RDI, RSP, 0);
+        x.load(true, RBX, RDI, 0);
+        x.load(true, RBP, RDI, 8);
+        x.load(true, R14, RDI, 16);
+        x.load(true, R15, RDI, 24);
+        x.load(false, R12, RDI, 32);
+        x.load(false, R13, RDI, 36);
+        x.jmpR(RSI);
+
+        exit_ = x.p;
+        x.load(true, RDI, RSP, 0);
+        x.store(true, R14, RDI, 16);
+        x.store(false, R12, RDI, 32);
+        x.store(false, R13, RDI, 36);
+        x.b(0x48); x.b(0x83); x.b(0xC4); x.b(0x08);          // add rsp, 8
+        for (int r : {R15, R14, R13, R12, RBP, RBX}) x.pop(r);
+        x.b(0xC3);
+
+        indirect_ = x.p;
+        x.aluImm(4, RAX, 0x7FFF);
+        x.rex(true, RDX, RAX, RBP); x.b(0x8B); x.mem(RDX, RBP, RAX, 8, 0);   // mov rdx, [rbp + rax*8]
+        x.rr(0x85, RDX, RDX, true);
+        x.jcc(0x84, exit_);
+        x.jmpR(RDX);
+        p_ = runtimeEnd_ = x.p;
+    }
+
+    void flush() {
+        fill(table_.begin(), table_.end(), nullptr);
+        for (auto& v : pending_) v.clear();
+        p_ = runtimeEnd_;
+    }
+
+    // Exit stub "mov eax, target; jmp exit", rewritten into "jmp block" once the target is compiled.
+    void chain(X64& x, uint32_t target) {
+        target &= 0x7FFF;
+        if (table_[target]) { x.jmp(table_[target]); return; }
+        uint8_t* stub = x.p;
+        x.movImm(RAX, target);
+        x.jmp(exit_);
+        if (m_.code[target].kind < K_HALT) pending_[target].push_back(stub);
+    }
+
+    void memOperand(X64& x, optional<uint16_t> knownA, int idx, bool store, int r) {
+        if (knownA) {
+            int32_t disp = (*knownA & 0x7FFF) * 2;
+            if (store) x.storeW(r, RBX, NOREG, 1, disp); else x.loadW(r, RBX, NOREG, 1, disp);
+            return;
+        }
+        x.rr(0x89, idx, R12);
+        x.aluImm(4, idx, 0x7FFF);
+        if (store) x.storeW(r, RBX, idx, 2, 0); else x.loadW(r, RBX, idx, 2, 0);
+    }
+
+    // eax = comp(D, y) with y in ecx.
+    static void emitAlu(X64& x, uint8_t comp) {
+        switch (comp) {
+            case 0b101010: x.rr(0x31, RAX, RAX); return;
+            case 0b111111: x.movImm(RAX, 1); return;
+            case 0b111010: x.movImm(RAX, 0xFFFF); return;
+            case 0b001100: x.rr(0x89, RAX, R13); return;
+            case 0b110000: x.rr(0x89, RAX, RCX); return;
+            case 0b001101: x.rr(0x89, RAX, R13); x.notR(RAX); return;
+            case 0b110001: x.rr(0x89, RAX, RCX); x.notR(RAX); return;
+            case 0b001111: x.rr(0x89, RAX, R13); x.negR(RAX); return;
+            case 0b110011: x.rr(0x89, RAX, RCX); x.negR(RAX); return;
+            case 0b011111: x.rr(0x89, RAX, R13); x.aluImm(0, RAX, 1); return;
+            case 0b110111: x.rr(0x89, RAX, RCX); x.aluImm(0, RAX, 1); return;
+            case 0b001110: x.rr(0x89, RAX, R13); x.aluImm(5, RAX, 1); return;
+            case 0b110010: x.rr(0x89, RAX, RCX); x.aluImm(5, RAX, 1); return;
+            case 0b000010: x.rr(0x89, RAX, R13); x.rr(0x01, RAX, RCX); return;
+            case 0b010011: x.rr(0x89, RAX, R13); x.rr(0x29, RAX, RCX); return;
+            case 0b000111: x.rr(0x89, RAX, RCX); x.rr(0x29, RAX, R13); return;
+            case 0b000000: x.rr(0x89, RAX, R13); x.rr(0x21, RAX, RCX); return;
+            case 0b010101: x.rr(0x89, RAX, R13); x.rr(0x09, RAX, RCX); return;
+        }
+        if (comp & 32) x.rr(0x31, RAX, RAX); else x.rr(0x89, RAX, R13);
+        if (comp & 16) x.notR(RAX);
+        if (comp & 8) x.rr(0x31, RCX, RCX);
+        if (comp & 4) x.notR(RCX);
+        x.rr(comp & 2 ? 0x01 : 0x21, RAX, RCX);
+        if (comp & 1) x.notR(RAX);
+    }
+
+    void compile(uint32_t start) {
+        if (static_cast<size_t>(buf_ + kBuffer - p_) < kMaxBlockBytes) flush();
+        const vector<Decoded>& code = m_.code;
+        uint32_t end = start;
+        while (!(code[end].kind == K_C && code[end].jump) && end - start + 1 < kMaxBlock &&
+               end + 1 < code.size() && code[end + 1].kind < K_HALT)
+            ++end;
+
+        X64 x{p_};
+        uint8_t* entry = x.p;
+        uint32_t len = end - start + 1;
+        // lea rax, [r14 + len]; cmp rax, r15; ja over; mov r14, rax
+        x.b(0x49); x.b(0x8D); x.b(0x86); x.d32(static_cast<int32_t>(len));
+        x.rr(0x39, RAX, R15, true);
+        uint8_t* over = x.jcc(0x87);
+        x.rr(0x89, R14, RAX, true);
+
+        static const uint8_t cc[8] = {0, 0x8F, 0x84, 0x8D, 0x8C, 0x85, 0x8E, 0};
+        optional<uint16_t> knownA;
+        bool jumped = false;
+        for (uint32_t pc = start; pc <= end; ++pc) {
+            const Decoded& d = code[pc];
+            if (d.kind == K_A) { x.movImm(R12, d.value); knownA = d.value; continue; }
+            if (!(d.comp & 8)) {                         // zy clear: the comp reads y
+                if (d.useM) memOperand(x, knownA, RCX, false, RCX);
+                else x.rr(0x89, RCX, R12);
+            }
+            emitAlu(x, d.comp);
+            x.zext16(RAX, RAX);
+            optional<uint16_t> target = knownA;          // a jump goes to A as it was before this instruction
+            int targetReg = R12;
+            if (d.jump && !target && (d.dest & 4)) { x.rr(0x89, RSI, R12); targetReg = RSI; }
+            if (d.dest & 1) memOperand(x, knownA, RDX, true, RAX);
+            if (d.dest & 2) x.rr(0x89, R13, RAX);
+            if (d.dest & 4) { x.rr(0x89, R12, RAX); knownA.reset(); }
+            if (!d.jump) continue;
+
+            uint8_t* taken = nullptr;
+            if (d.jump != 7) {
+                x.b(0x66); x.rr(0x85, RAX, RAX);        // test ax, ax
+                taken = x.jcc(cc[d.jump]);
+                chain(x, pc + 1);
+                X64::patch(taken, x.p);
+            }
+            if (target) chain(x, *target);
+            else { x.rr(0x89, RAX, targetReg); x.jmp(indirect_); }
+            jumped = true;
+        }
+        if (!jumped) chain(x, end + 1);
+        X64::patch(over, x.p);
+        x.movImm(RAX, start);
+        x.jmp(exit_);
+        p_ = x.p;
+
+        table_[start] = entry;
+        len_[start] = len;
+        ++blocks_;
+        for (uint8_t* stub : pending_[start]) { X64 s{stub}; s.jmp(entry); }
+        pending_[start].clear();
+    }
+};
+
+#endif
+
+// High-level emulation of Jack OS routines. The entry address of each routine
+// comes from the program's .asm (labels are counted as the assembler's pass 1
+// does, case-insensitively, so both "Math.multiply" and the official
+// translator's "math.multiply" match). On entry, LCL == SP and the arguments
+// are at ARG; a hook computes the result natively, then does what the VM
+// "return" sequence does (leaving R13, R14, A and D as the LAB7/LAB8
+// translators do). A hook may decline (bad
+// arguments, state it cannot see), in which case the Hack code runs as usual.
+//
+// With verify on, every call is also run instruction by instruction on the
+// plain ROM until it returns, and the two machine states are compared. Temp
+// (R5-R12), the translator's scratch R13-R15, A, D and the stack above SP are
+// not compared: the VM gives them no meaning after a return. The Hack run's
+// state is the one that continues.
+class Hle {
+public:
+    struct Routine {
+        const char* name;
+        int args;
+        bool (*fn)(Hle&, Machine&, const int16_t* arg, int16_t& result);
+    };
+
+    static const vector<Routine>& routines() {
+        static const vector<Routine> r = {
+            {"Math.multiply", 2, [](Hle&, Machine&, const int16_t* a, int16_t& r) {
+                r = static_cast<int16_t>(a[0] * a[1]); return true; }},
+            {"Math.divide", 2, [](Hle&, Machine&, const int16_t* a, int16_t& r) {
+                if (a[1] == 0 || a[0] == INT16_MIN || a[1] == INT16_MIN) return false;   // Sys.error / overflow
+                r = static_cast<int16_t>(a[0] / a[1]); return true; }},
+            {"Math.sqrt", 1, [](Hle&, Machine&, const int16_t* a, int16_t& r) {
+                if (a[0] < 0) return false;
+                int y = static_cast<int>(sqrt(static_cast<double>(a[0])));
+                while (y * y > a[0]) --y;
+                while ((y + 1) * (y + 1) <= a[0]) ++y;
+                r = static_cast<int16_t>(y); return true; }},
+            {"Math.abs", 1, [](Hle&, Machine&, const int16_t* a, int16_t& r) {
+                r = static_cast<int16_t>(a[0] < 0 ? -a[0] : a[0]); return true; }},
+            {"Math.min", 2, [](Hle&, Machine&, const int16_t* a, int16_t& r) { r = min(a[0], a[1]); return true; }},
+            {"Math.max", 2, [](Hle&, Machine&, const int16_t* a, int16_t& r) { r = max(a[0], a[1]); return true; }},
+            {"Memory.peek", 1, [](Hle&, Machine& m, const int16_t* a, int16_t& r) {
+                r = static_cast<int16_t>(m.ram[a[0] & 0x7FFF]); return true; }},
+            {"Memory.poke", 2, [](Hle&, Machine& m, const int16_t* a, int16_t& r) {
+                m.ram[a[0] & 0x7FFF] = static_cast<uint16_t>(a[1]); r = 0; return true; }},
+            // The colour lives in a Screen static whose address depends on the OS
+            // build, so setColor only records it and lets the Hack code run.
+            {"Screen.setColor", 1, [](Hle& h, Machine&, const int16_t* a, int16_t&) {
+                h.color_ = a[0] != 0; return false; }},
+            {"Screen.drawRectangle", 4, [](Hle& h, Machine& m, const int16_t* a, int16_t& r) {
+                int x1 = a[0], y1 = a[1], x2 = a[2], y2 = a[3];
+                if (h.color_ < 0 || x1 < 0 || x1 > x2 || x2 > 511 || y1 < 0 || y1 > y2 || y2 > 255) return false;
+                for (int y = y1; y <= y2; ++y) {
+                    for (int w = x1 / 16; w <= x2 / 16; ++w) {
+                        int lo = max(x1, w * 16) - w * 16, hi = min(x2, w * 16 + 15) - w * 16;
+                        uint16_t mask = static_cast<uint16_t>((0xFFFFu << lo) & (0xFFFFu >> (15 - hi)));
+                        uint16_t& word = m.ram[16384 + y * 32 + w];
+                        word = h.color_ ? word | mask : word & ~mask;
+                    }
+                }
+                r = 0; return true; }},
+        };
+        return r;
+    }
+
+    // Hooks the routines named in enable (all of them when it is empty) that the program contains.
+    Hle(Machine& m, const string& asmFile, const vector<string>& enable, bool verify) : verify_(verify) {
+        map<string, uint16_t> labels = readLabels(asmFile);
+        for (size_t i = 0; i < routines().size(); ++i) {
+            const Routine& r = routines()[i];
+            if (!enable.empty() && find(enable.begin(), enable.end(), r.name) == enable.end()) continue;
+            auto it = labels.find(lower(r.name));
+            if (it == labels.end() || m.code[it->second].kind >= K_HALT) continue;
+            m.code[it->second].kind = K_HOOK;
+            byPc_[it->second] = i;
+        }
+        for (const string& name : enable) {
+            bool known = any_of(routines().begin(), routines().end(), [&](const Routine& r) { return name == r.name; });
+            if (!known) throw runtime_error("no native version of " + name);
+        }
+        calls_.assign(routines().size(), 0);
+    }
+
+    // Runs the routine whose entry is at m.pc and leaves the machine at its return address.
+    void call(Machine& m, uint64_t limit) {
+        size_t i = byPc_.at(m.pc);
+        const Routine& r = routines()[i];
+        uint16_t* ram = m.ram.data();
+        int16_t arg[4];
+        for (int k = 0; k < r.args; ++k) arg[k] = static_cast<int16_t>(ram[(ram[2] + k) & 0x7FFF]);
+        if (!verify_) {
+            int16_t result = 0;
+            if (r.fn(*this, m, arg, result)) { vmReturn(m, result); ++calls_[i]; }
+            else interpret(m, m.cycles + 1, false);   // step past the hook; the Hack code takes it from here
+            return;
+        }
+
+        vector<uint16_t> before = m.ram;
+        uint16_t A = m.A, D = m.D, pc = m.pc;
+        int16_t result = 0;
+        if (!r.fn(*this, m, arg, result)) { interpret(m, m.cycles + 1, false); return; }
+        vmReturn(m, result);
+        ++calls_[i];
+        vector<uint16_t> fast = move(m.ram);
+        uint16_t fastPc = m.pc;
+        m.ram = move(before);
+        m.A = A; m.D = D; m.pc = pc;
+
+        uint16_t sp = static_cast<uint16_t>(m.ram[2] + 1);
+        uint16_t ret = m.ram[(m.ram[1] - 5) & 0x7FFF] & 0x7FFF;
+        do interpret(m, m.cycles + 1, false);
+        while (!(m.pc == ret && m.ram[0] == sp) && m.rom[m.pc].kind != K_HALT && m.cycles < limit);
+        if (m.pc != ret || m.ram[0] != sp) return;   // halted or out of cycles inside the routine
+
+        int bad = -1;
+        for (int a = 0; a < 32768 && bad < 0; ++a) {
+            if ((a >= 5 && a <= 15) || (a >= sp && a < 2048)) continue;
+            if (fast[a] != m.ram[a]) bad = a;
+        }
+        if (bad < 0 && fastPc != m.pc) bad = 32768;
+        if (bad < 0) return;
+        if (++mismatches_ <= 10) {
+            cerr << "hle: " << r.name << "(";
+            for (int k = 0; k < r.args; ++k) cerr << (k ? ", " : "") << arg[k];
+            cerr << ") differs at cycle " << m.cycles << ": ";
+            if (bad < 32768) cerr << "RAM[" << bad << "] = " << static_cast<int16_t>(fast[bad]) << ", expected " << static_cast<int16_t>(m.ram[bad]) << "\n";
+            else cerr << "pc = " << fastPc << ", expected " << m.pc << "\n";
+        }
+    }
+
+    size_t mismatches() const { return mismatches_; }
+
+    string summary() const {
+        string s;
+        for (size_t i = 0; i < calls_.size(); ++i)
+            if (calls_[i]) s += string(s.empty() ? "" : ", ") + routines()[i].name + " " + to_string(calls_[i]);
+        return s.empty() ? "no calls" : s;
+    }
+
+private:
+    bool verify_;
+    int color_ = -1;   // unknown until Screen.setColor is seen
+    unordered_map<uint16_t, size_t> byPc_;
+    vector<uint64_t> calls_;
+    size_t mismatches_ = 0;
+
+    static string lower(string s) {
+        for (char& c : s) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return s;
+    }
+
+    static map<string, uint16_t> readLabels(const string& file) {
+        ifstream in(file);
+        if (!in) throw runtime_error("cannot open " + file + " for the label map");
+        map<string, uint16_t> labels;
+        string line;
+        uint16_t pc = 0;
+        while (getline(in, line)) {
+            line = line.substr(0, line.find("//"));
+            line.erase(remove_if(line.begin(), line.end(), [](unsigned char c) { return isspace(c); }), line.end());
+            if (line.empty()) continue;
+            if (line[0] == '(') labels.emplace(lower(line.substr(1, line.size() - 2)), pc);
+            else ++pc;
+        }
+        return labels;
+    }
+
+    // The VM return sequence, with value as the routine's result.
+    static void vmReturn(Machine& m, int16_t value) {
+        uint16_t* ram = m.ram.data();
+        uint16_t frame = ram[1];
+        uint16_t ret = ram[(frame - 5) & 0x7FFF];
+        ram[ram[2] & 0x7FFF] = static_cast<uint16_t>(value);
+        ram[0] = static_cast<uint16_t>(ram[2] + 1);
+        ram[4] = ram[(frame - 1) & 0x7FFF];
+        ram[3] = ram[(frame - 2) & 0x7FFF];
+        ram[2] = ram[(frame - 3) & 0x7FFF];
+        ram[1] = ram[(frame - 4) & 0x7FFF];
+        ram[13] = static_cast<uint16_t>(frame - 4);
+        ram[14] = ret;
+        m.A = ret;
+        m.D = ram[1];
+        m.pc = ret & 0x7FFF;
+    }
+};
+
+static uint64_t fnv1a(const uint16_t* p, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 1099511628211ULL; }
+    return h;
+}
+
+// The 512x256 screen as a plain PBM image.
+static void writePbm(const Machine& m, const string& file) {
+    ofstream out(file);
+    out << "P1\n512 256\n";
+    for (int row = 0; row < 256; ++row) {
+        for (int col = 0; col < 512; ++col)
+            out << (m.ram[16384 + row * 32 + col / 16] >> (col % 16) & 1) << (col % 64 == 63 ? '\n' : ' ');
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string romFile, pbmFile;
+    uint64_t maxCycles = UINT64_MAX;
+    bool useJit = true, useHle = false, verifyHle = false;
+    string asmFile;
+    vector<string> hooks;
+    int dumpFrom = -1, dumpCount = 1;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--interp") useJit = false;
+        else if (a == "--jit") useJit = true;
+        else if (a.rfind("--max-cycles=", 0) == 0) maxCycles = stoull(a.substr(13));
+        else if (a.rfind("--screen=", 0) == 0) pbmFile = a.substr(9);
+        else if (a.rfind("--asm=", 0) == 0) asmFile = a.substr(6);
+        else if (a == "--hle-verify") useHle = verifyHle = true;
+        else if (a == "--hle" || a.rfind("--hle=", 0) == 0) {
+            useHle = true;
+            stringstream names(a.size() > 6 ? a.substr(6) : "");
+            for (string n; getline(names, n, ',');) if (!n.empty()) hooks.push_back(n);
+        }
+        else if (a.rfind("--dump=", 0) == 0) {
+            size_t colon = a.find(':');
+            dumpFrom = stoi(a.substr(7, colon - 7));
+            if (colon != string::npos) dumpCount = stoi(a.substr(colon + 1));
+        }
+        else romFile = a;
+    }
+    if (romFile.empty()) {
+        cerr << "Usage: " << argv[0] << " [--jit | --interp] [--max-cycles=N] [--dump=ADDR[:N]] [--screen=out.pbm]\n"
+             << "       [--hle[=Math.multiply,...] | --hle-verify] [--asm=labels.asm] <file.hack>" << endl;
+        return 1;
+    }
+
+    Machine m;
+    string engine = "interpreter";
+    unique_ptr<Hle> hle;
+    auto t0 = chrono::steady_clock::now();
+    try {
+        m.load(romFile);
+        if (useHle) {
+            if (asmFile.empty()) asmFile = romFile.substr(0, romFile.rfind('.')) + ".asm";
+            hle = make_unique<Hle>(m, asmFile, hooks, verifyHle);
+        }
+#ifdef HACK_JIT
+        unique_ptr<Jit> jit;
+        if (useJit) jit = make_unique<Jit>(m);
+#endif
+        while (true) {
+#ifdef HACK_JIT
+            if (jit) jit->run(maxCycles); else
+#endif
+            interpret(m, maxCycles);
+            if (!m.atHook() || m.cycles >= maxCycles) break;
+            hle->call(m, maxCycles);
+        }
+#ifdef HACK_JIT
+        if (jit)
+            engine = "jit, " + to_string(jit->blocks()) + " blocks, " + to_string(jit->codeBytes() >> 10) + " KB, " +
+                     to_string(jit->exits()) + " exits";
+#endif
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    for (int i = 0; dumpFrom >= 0 && i < dumpCount && dumpFrom + i < 32768; ++i)
+        cout << "RAM[" << dumpFrom + i << "] = " << static_cast<int16_t>(m.ram[dumpFrom + i]) << "\n";
+    if (!pbmFile.empty()) writePbm(m, pbmFile);
+    cerr << (m.halted() ? "halted" : "stopped") << " at pc=" << m.pc << " after " << m.cycles << " cycles in "
+         << fixed << setprecision(3) << secs << " s (" << setprecision(1) << m.cycles / secs / 1e6
+         << " MHz; " << engine << ")\n"
+         << "A=" << m.A << " D=" << m.D << " ram=" << hex << fnv1a(m.ram.data(), m.ram.size()) << dec << "\n";
+    if (hle) {
+        cerr << "hle: " << hle->summary() << "\n";
+        if (verifyHle) cerr << "hle: " << hle->mismatches() << " mismatches\n";
+        if (hle->mismatches()) return 2;
+    }
+    return 0;
+}
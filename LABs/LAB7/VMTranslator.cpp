@@ -1,10 +1,13 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
 #include <algorithm>
 #include <stdexcept>
+#include <charconv>
+#include "../stats.h"
 
 namespace fs = std::filesystem;
 
@@ -21,248 +24,391 @@ enum CommandType {
     C_CALL
 };
 
+// Arithmetic/logical operations and memory segments, resolved once by the Parser
+enum ArithmeticOp { OP_ADD, OP_SUB, OP_NEG, OP_EQ, OP_GT, OP_LT, OP_AND, OP_OR, OP_NOT, OP_UNKNOWN };
+enum Segment { S_CONSTANT, S_LOCAL, S_ARGUMENT, S_THIS, S_THAT, S_STATIC, S_TEMP, S_POINTER, S_UNKNOWN };
+
+// A decoded VM command. Views point into the Parser's source buffer and stay
+// valid for the lifetime of the Parser.
+struct Command {
+    CommandType type = C_ARITHMETIC;
+    ArithmeticOp op = OP_UNKNOWN;
+    Segment segment = S_UNKNOWN;
+    int index = 0;
+    std::string_view name;
+    std::string_view text;
+};
+
 // --- Class Definitions ---
 
 // CodeWriter class handles writing assembly code to the output file.
+// All output is collected in one buffer and written with a single call in close().
 class CodeWriter {
 public:
     CodeWriter(const std::string& filename);
-    void writeArithmetic(const std::string& command);
-    void writePushPop(CommandType command, const std::string& segment, int index);
+    void setFileName(const std::string& filename);
+    void writeInit();
+    void writeArithmetic(const Command& command);
+    void writePushPop(const Command& command);
+    void writeLabel(const Command& command);
+    void writeGoto(const Command& command);
+    void writeIf(const Command& command);
+    void writeFunction(const Command& command);
+    void writeCall(const Command& command);
+    void writeReturn();
     void close();
 
 private:
-    std::ofstream output_file;
+    std::string output_path;
+    std::string buffer;
     int jump_label_count;
+    int return_label_count;
     std::string file_name;
+    std::string function_name;
+
+    void writeCall(std::string_view function, int num_args);
+    void emitFunctionLabel(std::string_view label);
+    void pushD() { emit("@SP\nA=M\nM=D\n@SP\nM=M+1\n"); }
+
+    void emit(std::string_view s) { buffer.append(s); }
+    void emitInt(int value);
 };
 
 // Parser class handles reading and parsing a single .vm file.
+// The file is read in one go and decoded one line at a time on advance().
 class Parser {
 public:
     Parser(const std::string& filename);
     bool hasMoreCommands();
     void advance();
-    CommandType commandType();
-    std::string arg1();
-    int arg2();
+    CommandType commandType() const { return current.type; }
+    const Command& command() const { return current; }
 
 private:
-    std::ifstream input_file;
-    std::string current_command;
-    std::vector<std::string> commands;
-    int command_index;
+    std::string source;
+    size_t position;
+    Command current;
+    Command lookahead;
+    bool has_lookahead;
+
+    bool decodeNext(Command& out);
+    static bool decode(std::string_view line, Command& out);
 };
 
 
 // --- Class Implementations ---
 
+static const char* const kSegmentNames[] = {
+    "constant", "local", "argument", "this", "that", "static", "temp", "pointer"
+};
+
 // CodeWriter Implementation
-CodeWriter::CodeWriter(const std::string& filename) : jump_label_count(0) {
-    output_file.open(filename);
+CodeWriter::CodeWriter(const std::string& filename)
+    : output_path(filename), jump_label_count(0), return_label_count(0) {
+    buffer.reserve(1 << 20);
+    file_name = fs::path(filename).stem().string();
+}
+
+// Static variables are named <File>.<i>, so each .vm file gets its own static segment.
+void CodeWriter::setFileName(const std::string& filename) {
     file_name = fs::path(filename).stem().string();
 }
 
-void CodeWriter::writeArithmetic(const std::string& command) {
-    output_file << "// " << command << std::endl;
-    if (command == "add") {
-        output_file << "@SP" << std::endl;
-        output_file << "AM=M-1" << std::endl;
-        output_file << "D=M" << std::endl;
-        output_file << "A=A-1" << std::endl;
-        output_file << "M=D+M" << std::endl;
-    } else if (command == "sub") {
-        output_file << "@SP" << std::endl;
-        output_file << "AM=M-1" << std::endl;
-        output_file << "D=M" << std::endl;
-        output_file << "A=A-1" << std::endl;
-        output_file << "M=M-D" << std::endl;
-    } else if (command == "neg") {
-        output_file << "@SP" << std::endl;
-        output_file << "A=M-1" << std::endl;
-        output_file << "M=-M" << std::endl;
-    } else if (command == "eq" || command == "gt" || command == "lt") {
-        output_file << "@SP" << std::endl;
-        output_file << "AM=M-1" << std::endl;
-        output_file << "D=M" << std::endl;
-        output_file << "A=A-1" << std::endl;
-        output_file << "D=M-D" << std::endl;
-        output_file << "@TRUE" << jump_label_count << std::endl;
-        if (command == "eq") output_file << "D;JEQ" << std::endl;
-        if (command == "gt") output_file << "D;JGT" << std::endl;
-        if (command == "lt") output_file << "D;JLT" << std::endl;
-        output_file << "@SP" << std::endl;
-        output_file << "A=M-1" << std::endl;
-        output_file << "M=0" << std::endl;
-        output_file << "@END" << jump_label_count << std::endl;
-        output_file << "0;JMP" << std::endl;
-        output_file << "(TRUE" << jump_label_count << ")" << std::endl;
-        output_file << "@SP" << std::endl;
-        output_file << "A=M-1" << std::endl;
-        output_file << "M=-1" << std::endl;
-        output_file << "(END" << jump_label_count << ")" << std::endl;
+// Bootstrap code: SP = 256, then call Sys.init.
+void CodeWriter::writeInit() {
+    emit("// bootstrap\n@256\nD=A\n@SP\nM=D\n");
+    writeCall("Sys.init", 0);
+}
+
+void CodeWriter::emitInt(int value) {
+    char digits[16];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer.append(digits, result.ptr);
+}
+
+void CodeWriter::writeArithmetic(const Command& command) {
+    emit("// "); emit(command.text); emit("\n");
+    switch (command.op) {
+    case OP_ADD:
+        emit("@SP\nAM=M-1\nD=M\nA=A-1\nM=D+M\n");
+        break;
+    case OP_SUB:
+        emit("@SP\nAM=M-1\nD=M\nA=A-1\nM=M-D\n");
+        break;
+    case OP_NEG:
+        emit("@SP\nA=M-1\nM=-M\n");
+        break;
+    case OP_EQ:
+    case OP_GT:
+    case OP_LT:
+        emit("@SP\nAM=M-1\nD=M\nA=A-1\nD=M-D\n@TRUE"); emitInt(jump_label_count);
+        if (command.op == OP_EQ) emit("\nD;JEQ\n");
+        if (command.op == OP_GT) emit("\nD;JGT\n");
+        if (command.op == OP_LT) emit("\nD;JLT\n");
+        emit("@SP\nA=M-1\nM=0\n@END"); emitInt(jump_label_count);
+        emit("\n0;JMP\n(TRUE"); emitInt(jump_label_count);
+        emit(")\n@SP\nA=M-1\nM=-1\n(END"); emitInt(jump_label_count);
+        emit(")\n");
         jump_label_count++;
-    } else if (command == "and") {
-        output_file << "@SP" << std::endl;
-        output_file << "AM=M-1" << std::endl;
-        output_file << "D=M" << std::endl;
-        output_file << "A=A-1" << std::endl;
-        output_file << "M=D&M" << std::endl;
-    } else if (command == "or") {
-        output_file << "@SP" << std::endl;
-        output_file << "AM=M-1" << std::endl;
-        output_file << "D=M" << std::endl;
-        output_file << "A=A-1" << std::endl;
-        output_file << "M=D|M" << std::endl;
-    } else if (command == "not") {
-        output_file << "@SP" << std::endl;
-        output_file << "A=M-1" << std::endl;
-        output_file << "M=!M" << std::endl;
+        break;
+    case OP_AND:
+        emit("@SP\nAM=M-1\nD=M\nA=A-1\nM=D&M\n");
+        break;
+    case OP_OR:
+        emit("@SP\nAM=M-1\nD=M\nA=A-1\nM=D|M\n");
+        break;
+    case OP_NOT:
+        emit("@SP\nA=M-1\nM=!M\n");
+        break;
+    case OP_UNKNOWN:
+        break;
     }
 }
 
-void CodeWriter::writePushPop(CommandType commandType, const std::string& segment, int index) {
-    output_file << "// " << (commandType == C_PUSH ? "push" : "pop") << " " << segment << " " << index << std::endl;
-    if (segment == "constant") {
-        output_file << "@" << index << std::endl;
-        output_file << "D=A" << std::endl;
-        output_file << "@SP" << std::endl;
-        output_file << "A=M" << std::endl;
-        output_file << "M=D" << std::endl;
-        output_file << "@SP" << std::endl;
-        output_file << "M=M+1" << std::endl;
-    } else if (segment == "local" || segment == "argument" || segment == "this" || segment == "that") {
-        std::string seg_symbol;
-        if (segment == "local") seg_symbol = "LCL";
-        if (segment == "argument") seg_symbol = "ARG";
-        if (segment == "this") seg_symbol = "THIS";
-        if (segment == "that") seg_symbol = "THAT";
-
-        if (commandType == C_PUSH) {
-            output_file << "@" << seg_symbol << std::endl;
-            output_file << "D=M" << std::endl;
-            output_file << "@" << index << std::endl;
-            output_file << "A=D+A" << std::endl;
-            output_file << "D=M" << std::endl;
-            output_file << "@SP" << std::endl;
-            output_file << "A=M" << std::endl;
-            output_file << "M=D" << std::endl;
-            output_file << "@SP" << std::endl;
-            output_file << "M=M+1" << std::endl;
+void CodeWriter::writePushPop(const Command& command) {
+    int index = command.index;
+    if (command.segment == S_UNKNOWN) {
+        emit("// "); emit(command.text); emit("\n");
+        return;
+    }
+    emit(command.type == C_PUSH ? "// push " : "// pop ");
+    emit(kSegmentNames[command.segment]); emit(" "); emitInt(index); emit("\n");
+
+    switch (command.segment) {
+    case S_CONSTANT:
+        emit("@"); emitInt(index);
+        emit("\nD=A\n@SP\nA=M\nM=D\n@SP\nM=M+1\n");
+        break;
+    case S_LOCAL:
+    case S_ARGUMENT:
+    case S_THIS:
+    case S_THAT: {
+        const char* seg_symbol = command.segment == S_LOCAL ? "@LCL\n"
+                               : command.segment == S_ARGUMENT ? "@ARG\n"
+                               : command.segment == S_THIS ? "@THIS\n" : "@THAT\n";
+        emit(seg_symbol); emit("D=M\n@"); emitInt(index);
+        if (command.type == C_PUSH) {
+            emit("\nA=D+A\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n");
         } else { // C_POP
-            output_file << "@" << seg_symbol << std::endl;
-            output_file << "D=M" << std::endl;
-            output_file << "@" << index << std::endl;
-            output_file << "D=D+A" << std::endl;
-            output_file << "@R13" << std::endl;
-            output_file << "M=D" << std::endl;
-            output_file << "@SP" << std::endl;
-            output_file << "AM=M-1" << std::endl;
-            output_file << "D=M" << std::endl;
-            output_file << "@R13" << std::endl;
-            output_file << "A=M" << std::endl;
-            output_file << "M=D" << std::endl;
+            emit("\nD=D+A\n@R13\nM=D\n@SP\nAM=M-1\nD=M\n@R13\nA=M\nM=D\n");
         }
-    } else if (segment == "static" || segment == "temp" || segment == "pointer") {
-        std::string base_address;
-        if (segment == "static") base_address = std::to_string(16 + index);
-        if (segment == "temp") base_address = std::to_string(5 + index);
-        if (segment == "pointer") base_address = (index == 0 ? "THIS" : "THAT");
-
-        if (commandType == C_PUSH) {
-            if (segment == "pointer") output_file << "@" << (index == 0 ? "3" : "4") << std::endl;
-            else output_file << "@" << base_address << std::endl;
-            output_file << "D=M" << std::endl;
-            output_file << "@SP" << std::endl;
-            output_file << "A=M" << std::endl;
-            output_file << "M=D" << std::endl;
-            output_file << "@SP" << std::endl;
-            output_file << "M=M+1" << std::endl;
+        break;
+    }
+    case S_STATIC:
+    case S_TEMP:
+    case S_POINTER: {
+        if (command.type == C_POP) emit("@SP\nAM=M-1\nD=M\n");
+        emit("@");
+        if (command.segment == S_STATIC) { emit(file_name); emit("."); emitInt(index); }
+        else emitInt(command.segment == S_TEMP ? 5 + index : (index == 0 ? 3 : 4));
+        if (command.type == C_PUSH) {
+            emit("\nD=M\n@SP\nA=M\nM=D\n@SP\nM=M+1\n");
         } else { // C_POP
-             output_file << "@SP" << std::endl;
-             output_file << "AM=M-1" << std::endl;
-             output_file << "D=M" << std::endl;
-             if (segment == "pointer") output_file << "@" << (index == 0 ? "3" : "4") << std::endl;
-             else output_file << "@" << base_address << std::endl;
-             output_file << "M=D" << std::endl;
+            emit("\nM=D\n");
         }
+        break;
+    }
+    case S_UNKNOWN:
+        break;
+    }
+}
+
+// Labels are scoped to the enclosing function as <function>$<label>.
+void CodeWriter::emitFunctionLabel(std::string_view label) {
+    emit(function_name); emit("$"); emit(label);
+}
+
+void CodeWriter::writeLabel(const Command& command) {
+    emit("// "); emit(command.text); emit("\n(");
+    emitFunctionLabel(command.name);
+    emit(")\n");
+}
+
+void CodeWriter::writeGoto(const Command& command) {
+    emit("// "); emit(command.text); emit("\n@");
+    emitFunctionLabel(command.name);
+    emit("\n0;JMP\n");
+}
+
+void CodeWriter::writeIf(const Command& command) {
+    emit("// "); emit(command.text); emit("\n@SP\nAM=M-1\nD=M\n@");
+    emitFunctionLabel(command.name);
+    emit("\nD;JNE\n");
+}
+
+void CodeWriter::writeFunction(const Command& command) {
+    function_name.assign(command.name);
+    emit("// "); emit(command.text); emit("\n(");
+    emit(function_name); emit(")\n");
+    for (int i = 0; i < command.index; i++) {
+        emit("@SP\nA=M\nM=0\n@SP\nM=M+1\n");
     }
 }
 
+void CodeWriter::writeCall(const Command& command) {
+    emit("// "); emit(command.text); emit("\n");
+    writeCall(command.name, command.index);
+}
+
+// Pushes the return address and the caller's frame, repositions ARG and LCL,
+// then jumps to the callee.
+void CodeWriter::writeCall(std::string_view function, int num_args) {
+    std::string return_label = function_name.empty() ? "Bootstrap" : function_name;
+    return_label += "$ret.";
+    return_label += std::to_string(return_label_count++);
+
+    emit("@"); emit(return_label); emit("\nD=A\n"); pushD();
+    emit("@LCL\nD=M\n"); pushD();
+    emit("@ARG\nD=M\n"); pushD();
+    emit("@THIS\nD=M\n"); pushD();
+    emit("@THAT\nD=M\n"); pushD();
+    emit("@SP\nD=M\n@"); emitInt(num_args + 5);
+    emit("\nD=D-A\n@ARG\nM=D\n@SP\nD=M\n@LCL\nM=D\n@");
+    emit(function); emit("\n0;JMP\n(");
+    emit(return_label); emit(")\n");
+}
+
+// Copies the return value to ARG[0], restores the caller's frame from LCL-1..LCL-4
+// and jumps to the return address saved at LCL-5.
+void CodeWriter::writeReturn() {
+    emit("// return\n");
+    emit("@LCL\nD=M\n@R13\nM=D\n@5\nA=D-A\nD=M\n@R14\nM=D\n");
+    emit("@SP\nAM=M-1\nD=M\n@ARG\nA=M\nM=D\n@ARG\nD=M+1\n@SP\nM=D\n");
+    emit("@R13\nAM=M-1\nD=M\n@THAT\nM=D\n");
+    emit("@R13\nAM=M-1\nD=M\n@THIS\nM=D\n");
+    emit("@R13\nAM=M-1\nD=M\n@ARG\nM=D\n");
+    emit("@R13\nAM=M-1\nD=M\n@LCL\nM=D\n");
+    emit("@R14\nA=M\n0;JMP\n");
+}
+
 void CodeWriter::close() {
-    output_file << "(END)" << std::endl;
-    output_file << "@END" << std::endl;
-    output_file << "0;JMP" << std::endl;
-    output_file.close();
+    emit("(END)\n@END\n0;JMP\n");
+    Stats& stats = Stats::get();
+    if (stats.on()) {
+        stats.add("instructions", Stats::asmInstructions(buffer));
+        stats.add("bytes_out", static_cast<long long>(buffer.size()));
+    }
+    auto timer = stats.time("write");
+    std::ofstream output_file(output_path, std::ios::binary);
+    output_file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
 }
 
 // Parser Implementation
-Parser::Parser(const std::string& filename) : command_index(-1) {
-    input_file.open(filename);
+Parser::Parser(const std::string& filename) : position(0), has_lookahead(false) {
+    auto timer = Stats::get().time("read");
+    std::ifstream input_file(filename, std::ios::binary);
     if (!input_file.is_open()) {
         std::cerr << "Error opening file: " << filename << std::endl;
         exit(1);
     }
-
-    std::string line;
-    while (std::getline(input_file, line)) {
-        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
-        size_t comment_pos = line.find("//");
-        if (comment_pos != std::string::npos) {
-            line = line.substr(0, comment_pos);
-        }
-        line.erase(0, line.find_first_not_of(" \t"));
-        line.erase(line.find_last_not_of(" \t") + 1);
-
-        if (!line.empty()) {
-            commands.push_back(line);
-        }
-    }
+    input_file.seekg(0, std::ios::end);
+    source.resize(static_cast<size_t>(input_file.tellg()));
+    input_file.seekg(0, std::ios::beg);
+    input_file.read(source.data(), static_cast<std::streamsize>(source.size()));
+    Stats::get().add("bytes_in", static_cast<long long>(source.size()));
 }
 
 bool Parser::hasMoreCommands() {
-    return command_index < (int)commands.size() - 1;
+    if (!has_lookahead) has_lookahead = decodeNext(lookahead);
+    return has_lookahead;
 }
 
 void Parser::advance() {
     if (hasMoreCommands()) {
-        command_index++;
-        current_command = commands[command_index];
+        current = lookahead;
+        has_lookahead = false;
     }
 }
 
-CommandType Parser::commandType() {
-    if (current_command.find("push") != std::string::npos) return C_PUSH;
-    if (current_command.find("pop") != std::string::npos) return C_POP;
-    return C_ARITHMETIC;
-}
+// Scans forward to the next non-empty line and decodes it.
+bool Parser::decodeNext(Command& out) {
+    const size_t size = source.size();
+    while (position < size) {
+        size_t end = source.find('\n', position);
+        if (end == std::string::npos) end = size;
+        std::string_view line(source.data() + position, end - position);
+        position = end + 1;
+
+        size_t comment_pos = line.find("//");
+        if (comment_pos != std::string_view::npos) line = line.substr(0, comment_pos);
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string_view::npos) continue;
+        line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
 
-std::string Parser::arg1() {
-    if (commandType() == C_ARITHMETIC) {
-        return current_command;
+        if (decode(line, out)) return true;
     }
-    size_t first_space = current_command.find(" ");
-    size_t second_space = current_command.find(" ", first_space + 1);
-    return current_command.substr(first_space + 1, second_space - first_space - 1);
+    return false;
 }
 
-int Parser::arg2() {
-    size_t last_space = current_command.rfind(" ");
-    return std::stoi(current_command.substr(last_space + 1));
+// Splits a trimmed line into words and resolves the command and its arguments.
+bool Parser::decode(std::string_view line, Command& out) {
+    std::string_view words[3];
+    size_t count = 0, i = 0;
+    while (i < line.size() && count < 3) {
+        size_t start = i;
+        while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') i++;
+        words[count++] = line.substr(start, i - start);
+        while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) i++;
+    }
+
+    out = Command();
+    out.text = line;
+    std::string_view op = words[0];
+    if (op == "label" || op == "goto" || op == "if-goto") {
+        out.type = (op == "label") ? C_LABEL : (op == "goto") ? C_GOTO : C_IF;
+        out.name = words[1];
+        return true;
+    }
+    if (op == "function" || op == "call") {
+        out.type = (op == "function") ? C_FUNCTION : C_CALL;
+        out.name = words[1];
+        std::from_chars(words[2].data(), words[2].data() + words[2].size(), out.index);
+        return true;
+    }
+    if (op == "return") {
+        out.type = C_RETURN;
+        return true;
+    }
+    if (op == "push" || op == "pop") {
+        out.type = (op == "push") ? C_PUSH : C_POP;
+        for (int s = S_CONSTANT; s < S_UNKNOWN; ++s) {
+            if (words[1] == kSegmentNames[s]) { out.segment = static_cast<Segment>(s); break; }
+        }
+        std::from_chars(words[2].data(), words[2].data() + words[2].size(), out.index);
+        return true;
+    }
+
+    out.type = C_ARITHMETIC;
+    if (op == "add") out.op = OP_ADD;
+    else if (op == "sub") out.op = OP_SUB;
+    else if (op == "neg") out.op = OP_NEG;
+    else if (op == "eq") out.op = OP_EQ;
+    else if (op == "gt") out.op = OP_GT;
+    else if (op == "lt") out.op = OP_LT;
+    else if (op == "and") out.op = OP_AND;
+    else if (op == "or") out.op = OP_OR;
+    else if (op == "not") out.op = OP_NOT;
+    return true;
 }
 
 
 // --- Main Function ---
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <file.vm or directory>" << std::endl;
+    Stats& stats = Stats::get();
+    std::string input_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (!stats.parseFlag(arg, "VMTranslator")) input_path = arg;
+    }
+    if (input_path.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--stats[=text|json][:file]] <file.vm or directory>" << std::endl;
         return 1;
     }
 
     std::vector<std::string> vm_files;
     std::string output_file;
-    std::string input_path = argv[1];
+    bool bootstrap = false;
 
     if (fs::is_directory(input_path)) {
         fs::path dir_path(input_path);
@@ -270,28 +416,44 @@ int main(int argc, char* argv[]) {
         for (const auto& entry : fs::directory_iterator(input_path)) {
             if (entry.path().extension() == ".vm") {
                 vm_files.push_back(entry.path().string());
+                if (entry.path().filename() == "Sys.vm") bootstrap = true;
             }
         }
+        std::sort(vm_files.begin(), vm_files.end());
     } else {
         vm_files.push_back(input_path);
         output_file = fs::path(input_path).replace_extension(".asm").string();
     }
 
     CodeWriter code_writer(output_file);
+    if (bootstrap) code_writer.writeInit();
 
+    long long commands = 0;
     for (const auto& file : vm_files) {
         Parser parser(file);
+        code_writer.setFileName(file);
+        auto timer = stats.time("translate");
         while (parser.hasMoreCommands()) {
             parser.advance();
-            if (parser.commandType() == C_ARITHMETIC) {
-                code_writer.writeArithmetic(parser.arg1());
-            } else if (parser.commandType() == C_PUSH || parser.commandType() == C_POP) {
-                code_writer.writePushPop(parser.commandType(), parser.arg1(), parser.arg2());
+            ++commands;
+            const Command& command = parser.command();
+            switch (command.type) {
+            case C_ARITHMETIC: code_writer.writeArithmetic(command); break;
+            case C_PUSH:
+            case C_POP:        code_writer.writePushPop(command); break;
+            case C_LABEL:      code_writer.writeLabel(command); break;
+            case C_GOTO:       code_writer.writeGoto(command); break;
+            case C_IF:         code_writer.writeIf(command); break;
+            case C_FUNCTION:   code_writer.writeFunction(command); break;
+            case C_CALL:       code_writer.writeCall(command); break;
+            case C_RETURN:     code_writer.writeReturn(); break;
             }
         }
     }
+    stats.add("files", static_cast<long long>(vm_files.size()));
+    stats.add("vm_commands", commands);
 
     code_writer.close();
 
     return 0;
-}
\ No newline at end of file
+}
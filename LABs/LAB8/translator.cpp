@@ -1,5 +1,6 @@
 #include <bits/stdc++.h>
 #include <filesystem>
+#include "../stats.h"
 using namespace std;
 namespace fs = std::filesystem;
 
@@ -64,16 +65,27 @@ struct VMParser {
     }
 };
 
+enum Policy { P_SPEED, P_SIZE };
+
+// Each module is written into its own buffer; label counters restart per module
+// and every generated label carries the module or function name, so modules
+// can be translated independently and concatenated in any order of completion.
 struct AsmWriter {
-    ofstream out;
+    ostringstream out;
     string moduleTag;
     string funcTag = "null";
     int jcnt = 0;
     int ccnt = 0;
+    Policy policy = P_SPEED;
+    bool usedCall = false, usedRet = false, usedCmp = false;
 
-    explicit AsmWriter(const string& fout) { out.open(fout); }
+    explicit AsmWriter(Policy p = P_SPEED) : policy(p) {}
 
-    void setModule(const string& path) { moduleTag = fs::path(path).stem().string();}
+    void setModule(const string& path) {
+        moduleTag = fs::path(path).stem().string();
+        funcTag = moduleTag;
+        jcnt = ccnt = 0;
+    }
 
     void bootstrap() {
         out << "@256\nD=A\n@SP\nM=D\n";
@@ -91,9 +103,15 @@ struct AsmWriter {
             out << "@SP\nA=M-1\n";
             if (op=="neg") out << "M=-M\n";
             else out << "M=!M\n";
+        } else if (policy == P_SIZE) {
+            // trampoline into the shared $$CMP routine, which returns through R15
+            string ret = moduleTag + "$CMP." + to_string(jcnt++);
+            const char* entry = op=="eq" ? "$$CMP.EQ" : op=="gt" ? "$$CMP.GT" : "$$CMP.LT";
+            out << "@" << ret << "\nD=A\n@" << entry << "\n0;JMP\n(" << ret << ")\n";
+            usedCmp = true;
         } else {
-            string t = "T" + to_string(jcnt);
-            string e = "E" + to_string(jcnt++);
+            string t = moduleTag + "$T." + to_string(jcnt);
+            string e = moduleTag + "$E." + to_string(jcnt++);
             out << "@SP\nAM=M-1\nD=M\nA=A-1\nD=M-D\n@" << t << "\n";
             if (op=="eq") out << "D;JEQ\n";
             else if (op=="gt") out << "D;JGT\n";
@@ -143,6 +161,13 @@ struct AsmWriter {
 
     void writeCall(const string& name, int nargs) {
         string ret = funcTag + "$RET." + to_string(ccnt++);
+        if (policy == P_SIZE) {
+            // R14 = nargs+5, R13 = callee, D = return address; $$CALL builds the frame
+            out << "@" << (nargs + 5) << "\nD=A\n@R14\nM=D\n@" << name << "\nD=A\n@R13\nM=D\n";
+            out << "@" << ret << "\nD=A\n@$$CALL\n0;JMP\n(" << ret << ")\n";
+            usedCall = true;
+            return;
+        }
         out << "@" << ret << "\nD=A\n"; pushD();
         const char* regs[] = {"@LCL","@ARG","@THIS","@THAT"};
         for (auto r: regs) { out << r << "\nD=M\n"; pushD(); }
@@ -152,6 +177,11 @@ struct AsmWriter {
     }
 
     void writeReturn() {
+        if (policy == P_SIZE) { out << "@$$RETURN\n0;JMP\n"; usedRet = true; return; }
+        writeReturnBody();
+    }
+
+    void writeReturnBody() {
         out << "@LCL\nD=M\n@R13\nM=D\n@5\nA=D-A\nD=M\n@R14\nM=D\n";
         out << "@SP\nAM=M-1\nD=M\n@ARG\nA=M\nM=D\n@ARG\nD=M+1\n@SP\nM=D\n";
         const char* regs[] = {"@THAT","@THIS","@ARG","@LCL"};
@@ -159,12 +189,80 @@ struct AsmWriter {
         out << "@R14\nA=M\n0;JMP\n";
     }
 
-    void close() { out.close(); }
+    // Shared routines for the size policy; only reachable by jumps, so they go after all code.
+    void writeSharedRoutines() {
+        if (usedCall) {
+            out << "($$CALL)\n";
+            pushD();
+            const char* regs[] = {"@LCL","@ARG","@THIS","@THAT"};
+            for (auto r: regs) { out << r << "\nD=M\n"; pushD(); }
+            out << "@R14\nD=M\n@SP\nD=M-D\n@ARG\nM=D\n";
+            out << "@SP\nD=M\n@LCL\nM=D\n";
+            out << "@R13\nA=M\n0;JMP\n";
+        }
+        if (usedRet) {
+            out << "($$RETURN)\n";
+            writeReturnBody();
+        }
+        if (usedCmp) {
+            // result slot is preset to true; D still holds x-y for the jump test
+            const char* tests[][2] = {{"EQ","JEQ"},{"GT","JGT"},{"LT","JLT"}};
+            for (auto& t: tests) {
+                out << "($$CMP." << t[0] << ")\n@R15\nM=D\n@SP\nAM=M-1\nD=M\nA=A-1\nD=M-D\nM=-1\n";
+                out << "@$$CMP.RET\nD;" << t[1] << "\n@$$CMP.FALSE\n0;JMP\n";
+            }
+            out << "($$CMP.FALSE)\n@SP\nA=M-1\nM=0\n($$CMP.RET)\n@R15\nA=M\n0;JMP\n";
+        }
+    }
+
+    void merge(const AsmWriter& m) {
+        out << m.out.str();
+        usedCall |= m.usedCall; usedRet |= m.usedRet; usedCmp |= m.usedCmp;
+    }
 };
 
+static void translateFile(const string& f, AsmWriter& W) {
+    Stats& stats = Stats::get();
+    auto timer = stats.time("translate");
+    W.setModule(f);
+    VMParser P(f);
+    long long commands = 0;
+    while (P.next()) {
+        ++commands;
+        Cmd t = P.type();
+        switch (t) {
+            case T_ARITH:    W.writeArithmetic(P.a1()); break;
+            case T_PUSH:     W.writePushPop(T_PUSH, P.a1(), P.a2()); break;
+            case T_POP:      W.writePushPop(T_POP, P.a1(), P.a2()); break;
+            case T_LABEL:    W.writeLabel(P.a1()); break;
+            case T_GOTO:     W.writeGoto(P.a1()); break;
+            case T_IF:       W.writeIf(P.a1()); break;
+            case T_FUNCTION: W.writeFunction(P.a1(), P.a2()); break;
+            case T_CALL:     W.writeCall(P.a1(), P.a2()); break;
+            case T_RETURN:   W.writeReturn(); break;
+        }
+    }
+    stats.add("vm_commands", commands);
+    if (stats.on()) stats.add("bytes_in", static_cast<long long>(fs::file_size(f)));
+}
+
 int main(int argc, char* argv[]) {
-    string inPath = argv[1];
-    vector<string> files;
+    string inPath;
+    Policy policy = P_SPEED;
+    bool parallel = false;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--policy=size") policy = P_SIZE;
+        else if (a == "--policy=speed") policy = P_SPEED;
+        else if (a == "--parallel") parallel = true;
+        else if (Stats::get().parseFlag(a, "translator")) continue;
+        else inPath = a;
+    }
+    if (inPath.empty()) {
+        cerr << "Usage: " << argv[0] << " [--policy=speed|size] [--parallel] [--stats[=text|json][:file]] <file.vm | directory>" << endl;
+        return 1;
+    }
+    vector<string> files, asmFiles;
     string outPath;
     bool isDir = fs::is_directory(inPath);
 
@@ -173,35 +271,58 @@ int main(int argc, char* argv[]) {
         outPath = (p / p.filename()).string() + ".asm";
         for (auto& e : fs::directory_iterator(inPath)) {
             if (e.path().extension() == ".vm") files.push_back(e.path().string());
+            // classes the Jack compiler lowered straight to assembly (.s) are linked as they are
+            else if (e.path().extension() == ".s") {
+                fs::path twin = e.path(); twin.replace_extension(".vm");
+                if (fs::exists(twin)) cerr << "warning: " << e.path().string() << " ignored, " << twin.string() << " is used instead" << endl;
+                else asmFiles.push_back(e.path().string());
+            }
         }
         sort(files.begin(), files.end());
+        sort(asmFiles.begin(), asmFiles.end());
     } else {
         files.push_back(inPath);
         outPath = fs::path(inPath).replace_extension(".asm").string();
     }
 
-    AsmWriter W(outPath);
-    if (isDir) W.bootstrap();
-
-    for (const auto& f : files) {
-        W.setModule(f);
-        VMParser P(f);
-        while (P.next()) {
-            Cmd t = P.type();
-            switch (t) {
-                case T_ARITH:    W.writeArithmetic(P.a1()); break;
-                case T_PUSH:     W.writePushPop(T_PUSH, P.a1(), P.a2()); break;
-                case T_POP:      W.writePushPop(T_POP, P.a1(), P.a2()); break;
-                case T_LABEL:    W.writeLabel(P.a1()); break;
-                case T_GOTO:     W.writeGoto(P.a1()); break;
-                case T_IF:       W.writeIf(P.a1()); break;
-                case T_FUNCTION: W.writeFunction(P.a1(), P.a2()); break;
-                case T_CALL:     W.writeCall(P.a1(), P.a2()); break;
-                case T_RETURN:   W.writeReturn(); break;
-            }
+    vector<AsmWriter> mods;
+    for (size_t i = 0; i < files.size(); ++i) mods.emplace_back(policy);
+    if (parallel && files.size() > 1) {
+        atomic<size_t> next{0};
+        auto worker = [&] {
+            for (size_t i; (i = next++) < files.size(); ) translateFile(files[i], mods[i]);
+        };
+        size_t n = min<size_t>(files.size(), max(1u, thread::hardware_concurrency()));
+        vector<thread> pool;
+        for (size_t i = 0; i < n; ++i) pool.emplace_back(worker);
+        for (auto& t : pool) t.join();
+    } else {
+        for (size_t i = 0; i < files.size(); ++i) translateFile(files[i], mods[i]);
+    }
+
+    Stats& stats = Stats::get();
+    AsmWriter W(policy);
+    {
+        auto timer = stats.time("link");
+        if (isDir) W.bootstrap();
+        for (const auto& m : mods) W.merge(m);
+        for (const auto& f : asmFiles) {
+            ifstream in(f);
+            W.out << in.rdbuf();
         }
+        W.writeSharedRoutines();
     }
 
-    W.close();
+    string text = W.out.str();
+    {
+        auto timer = stats.time("write");
+        ofstream out(outPath);
+        out << text;
+    }
+    stats.add("files", static_cast<long long>(files.size() + asmFiles.size()));
+    if (stats.on()) {
+        stats.add("instructions", Stats::asmInstructions(text));
+        stats.add("bytes_out", static_cast<long long>(text.size()));
+    }
     return 0;
 }
@@ -0,0 +1,320 @@
+#include <bits/stdc++.h>
+#include <filesystem>
+using namespace std;
+namespace fs = std::filesystem;
+
+// Whole-program optimizer over a directory of .vm files, run before the
+// translator lowers them. Small leaf functions are expanded at their call
+// sites (--inline=N, N = body size in VM commands), functions unreachable
+// from the entry points are dropped (--shake), and the ROM cost of what was
+// removed is reported using the same instruction counts the translator emits.
+
+struct VMCmd {
+    string op, a1;
+    int a2 = 0;
+};
+
+struct Function {
+    string name;
+    vector<VMCmd> body;          // includes the leading "function" command
+};
+
+struct Module {
+    string file;                 // output file name, e.g. "Ball.vm"
+    string cls;                  // class name taken from the file name
+    vector<VMCmd> prologue;      // commands before the first function, kept as is
+    vector<Function> funcs;
+};
+
+enum Policy { P_SPEED, P_SIZE };
+
+static void trim(string& s) {
+    size_t p = s.find("//");
+    if (p != string::npos) s.erase(p);
+    size_t l = s.find_first_not_of(" \t\r\n");
+    if (l == string::npos) { s.clear(); return; }
+    size_t r = s.find_last_not_of(" \t\r\n");
+    s = s.substr(l, r - l + 1);
+}
+
+static Module loadModule(const fs::path& path) {
+    ifstream in(path);
+    if (!in) throw runtime_error("cannot open input: " + path.string());
+    Module m;
+    m.file = path.filename().string();
+    m.cls = path.stem().string();
+    string line;
+    while (getline(in, line)) {
+        trim(line);
+        if (line.empty()) continue;
+        istringstream ss(line);
+        VMCmd c;
+        ss >> c.op >> c.a1 >> c.a2;
+        if (c.op == "function") m.funcs.push_back({c.a1, {}});
+        if (m.funcs.empty()) m.prologue.push_back(c);
+        else m.funcs.back().body.push_back(c);
+    }
+    return m;
+}
+
+static void writeCmd(ostream& out, const VMCmd& c) {
+    out << c.op;
+    if (!c.a1.empty()) out << ' ' << c.a1;
+    if (c.op == "push" || c.op == "pop" || c.op == "function" || c.op == "call") out << ' ' << c.a2;
+    out << '\n';
+}
+
+// Hack instructions the LAB8 translator emits for one VM command. The bootstrap
+// and the shared $$CALL/$$RETURN/$$CMP routines of the size policy are not counted.
+static int asmWords(const VMCmd& c, Policy policy) {
+    const string& op = c.op;
+    if (op == "push") {
+        if (c.a1 == "local" || c.a1 == "argument" || c.a1 == "this" || c.a1 == "that") return 10;
+        return 7;
+    }
+    if (op == "pop") {
+        if (c.a1 == "local" || c.a1 == "argument" || c.a1 == "this" || c.a1 == "that") return 12;
+        return 10;
+    }
+    if (op == "add" || op == "sub" || op == "and" || op == "or") return 5;
+    if (op == "neg" || op == "not") return 3;
+    if (op == "eq" || op == "gt" || op == "lt") return policy == P_SIZE ? 4 : 15;
+    if (op == "label") return 0;
+    if (op == "goto") return 2;
+    if (op == "if-goto") return 5;
+    if (op == "function") return 5 * c.a2;
+    if (op == "call") return policy == P_SIZE ? 12 : 49;
+    if (op == "return") return policy == P_SIZE ? 2 : 42;
+    return 0;
+}
+
+static int asmWords(const Function& f, Policy policy) {
+    int n = 0;
+    for (auto& c : f.body) n += asmWords(c, policy);
+    return n;
+}
+
+// Marks every function reachable through call edges from the roots.
+static set<string> reachable(const vector<Module>& mods, const vector<string>& roots) {
+    unordered_map<string, const Function*> byName;
+    for (auto& m : mods) for (auto& f : m.funcs) byName[f.name] = &f;
+    set<string> seen;
+    vector<string> work;
+    for (auto& r : roots) if (byName.count(r) && seen.insert(r).second) work.push_back(r);
+    for (auto& m : mods) for (auto& c : m.prologue)
+        if (c.op == "call" && seen.insert(c.a1).second) work.push_back(c.a1);
+    while (!work.empty()) {
+        string f = work.back(); work.pop_back();
+        auto it = byName.find(f);
+        if (it == byName.end()) continue;
+        for (auto& c : it->second->body)
+            if (c.op == "call" && seen.insert(c.a1).second) work.push_back(c.a1);
+    }
+    return seen;
+}
+
+static void shake(vector<Module>& mods, const vector<string>& roots, Policy policy) {
+    set<string> live = reachable(mods, roots);
+    int totalBefore = 0, totalSaved = 0, totalRemoved = 0;
+    cerr << left << setw(16) << "class" << right << setw(8) << "funcs" << setw(9) << "removed"
+         << setw(10) << "words" << setw(10) << "saved" << endl;
+    for (auto& m : mods) {
+        int before = 0, saved = 0, removed = 0;
+        size_t n = m.funcs.size();
+        vector<Function> kept;
+        for (auto& f : m.funcs) {
+            int w = asmWords(f, policy);
+            before += w;
+            if (live.count(f.name)) kept.push_back(std::move(f));
+            else { saved += w; ++removed; }
+        }
+        m.funcs = std::move(kept);
+        cerr << left << setw(16) << m.cls << right << setw(8) << n << setw(9) << removed
+             << setw(10) << before << setw(10) << saved << endl;
+        totalBefore += before; totalSaved += saved; totalRemoved += removed;
+    }
+    cerr << left << setw(16) << "total" << right << setw(8) << "" << setw(9) << totalRemoved
+         << setw(10) << totalBefore << setw(10) << totalSaved << endl;
+}
+
+// Stack depth after each command, relative to function entry. Fails (returns
+// false) when a jump target is reached at two different depths or a return
+// leaves anything but the result on the stack, since the inlined body would
+// then not leave the caller's stack the way a real return does.
+static bool balanced(const Function& f, int nargs) {
+    unordered_map<string, int> at;
+    int depth = 0;
+    bool live = true;
+    for (size_t i = 1; i < f.body.size(); ++i) {
+        const VMCmd& c = f.body[i];
+        const string& op = c.op;
+        if (op == "label") {
+            auto it = at.find(c.a1);
+            if (!live) { if (it == at.end()) return false; depth = it->second; live = true; }
+            else if (it != at.end() && it->second != depth) return false;
+            at[c.a1] = depth;
+            continue;
+        }
+        if (!live) return false;
+        if (op == "push") {
+            if (c.a1 == "argument" && c.a2 >= nargs) return false;
+            ++depth;
+        }
+        else if (op == "pop") {
+            if (c.a1 == "argument" && c.a2 >= nargs) return false;
+            --depth;
+        }
+        else if (op == "add" || op == "sub" || op == "and" || op == "or" ||
+                 op == "eq" || op == "gt" || op == "lt") --depth;
+        else if (op == "neg" || op == "not") {}
+        else if (op == "goto" || op == "if-goto") {
+            if (op == "if-goto") --depth;
+            auto it = at.find(c.a1);
+            if (it != at.end() && it->second != depth) return false;
+            at[c.a1] = depth;
+            if (op == "goto") live = false;
+        }
+        else if (op == "return") { if (depth != 1) return false; live = false; }
+        else return false;
+        if (depth < 0) return false;
+    }
+    return !live;
+}
+
+struct InlineSite {
+    const Function* fn;
+    const Module* mod;
+    bool usesStatic = false, setsThis = false, setsThat = false;
+    int nlocals = 0;
+    int returns = 0;
+};
+
+// Replaces calls to small leaf functions with their bodies. Arguments are
+// popped into fresh caller locals, callee locals follow them, and THIS/THAT
+// are saved around bodies that move them, since return would have restored
+// them. Labels get a per-site prefix so they stay unique within the caller.
+static void inlineCalls(vector<Module>& mods, int maxSize) {
+    unordered_map<string, InlineSite> cand;
+    for (auto& m : mods) for (auto& f : m.funcs) {
+        if (f.body.size() - 1 > (size_t)maxSize) continue;
+        InlineSite s{&f, &m};
+        s.nlocals = f.body[0].a2;
+        bool leaf = true;
+        for (auto& c : f.body) {
+            if (c.op == "call") leaf = false;
+            if (c.op == "return") ++s.returns;
+            if ((c.op == "push" || c.op == "pop") && c.a1 == "static") s.usesStatic = true;
+            if (c.op == "pop" && c.a1 == "pointer") (c.a2 == 0 ? s.setsThis : s.setsThat) = true;
+        }
+        if (!leaf || s.returns == 0) continue;
+        cand[f.name] = s;
+    }
+
+    map<pair<string, string>, int> sites;    // (callee, caller) -> count
+    map<string, string> skipped;             // callee -> reason
+    for (auto& m : mods) for (auto& f : m.funcs) {
+        if (cand.count(f.name)) continue;
+        int base = f.body[0].a2, extra = 0, seq = 0;
+        vector<VMCmd> out;
+        out.reserve(f.body.size());
+        for (auto& c : f.body) {
+            auto it = c.op == "call" ? cand.find(c.a1) : cand.end();
+            if (it == cand.end()) { out.push_back(c); continue; }
+            const InlineSite& s = it->second;
+            int nargs = c.a2;
+            if (s.usesStatic && s.mod != &m) { skipped[c.a1] = "uses static of another class"; out.push_back(c); continue; }
+            if (!balanced(*s.fn, nargs)) { skipped[c.a1] = "cannot show the stack is balanced at return"; out.push_back(c); continue; }
+
+            string pre = "INLINE" + to_string(seq++) + ".";
+            int argBase = base, locBase = base + nargs, slot = locBase + s.nlocals;
+            int saveThis = s.setsThis ? slot++ : -1, saveThat = s.setsThat ? slot++ : -1;
+            extra = max(extra, slot - base);
+            for (int i = nargs - 1; i >= 0; --i) out.push_back({"pop", "local", argBase + i});
+            for (int i = 0; i < s.nlocals; ++i) {
+                out.push_back({"push", "constant", 0});
+                out.push_back({"pop", "local", locBase + i});
+            }
+            if (saveThis >= 0) { out.push_back({"push", "pointer", 0}); out.push_back({"pop", "local", saveThis}); }
+            if (saveThat >= 0) { out.push_back({"push", "pointer", 1}); out.push_back({"pop", "local", saveThat}); }
+            const auto& body = s.fn->body;
+            bool joins = false;
+            for (size_t i = 1; i < body.size(); ++i) {
+                VMCmd b = body[i];
+                if (b.op == "label" || b.op == "goto" || b.op == "if-goto") b.a1 = pre + b.a1;
+                else if (b.a1 == "argument") { b.a1 = "local"; b.a2 += argBase; }
+                else if (b.a1 == "local") b.a2 += locBase;
+                else if (b.op == "return") {
+                    if (i + 1 == body.size()) continue;
+                    b = {"goto", pre + "RETURN", 0};
+                    joins = true;
+                }
+                out.push_back(b);
+            }
+            if (joins) out.push_back({"label", pre + "RETURN", 0});
+            if (saveThis >= 0) { out.push_back({"push", "local", saveThis}); out.push_back({"pop", "pointer", 0}); }
+            if (saveThat >= 0) { out.push_back({"push", "local", saveThat}); out.push_back({"pop", "pointer", 1}); }
+            ++sites[{c.a1, f.name}];
+        }
+        out[0].a2 += extra;
+        f.body = std::move(out);
+    }
+
+    for (auto& [k, n] : sites)
+        cerr << "inline " << k.first << " (" << cand[k.first].fn->body.size() - 1 << " cmds) into "
+             << k.second << (n > 1 ? " x" + to_string(n) : "") << endl;
+    for (auto& [callee, why] : skipped)
+        cerr << "keep call " << callee << ": " << why << endl;
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> paths;
+    vector<string> roots;
+    bool doShake = false;
+    int inlineSize = 0;
+    Policy policy = P_SPEED;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--shake") doShake = true;
+        else if (a.rfind("--inline=", 0) == 0) inlineSize = stoi(a.substr(9));
+        else if (a.rfind("--keep=", 0) == 0) roots.push_back(a.substr(7));
+        else if (a == "--policy=size") policy = P_SIZE;
+        else if (a == "--policy=speed") policy = P_SPEED;
+        else paths.push_back(a);
+    }
+    if (paths.size() != 2 || !fs::is_directory(paths[0])) {
+        cerr << "Usage: " << argv[0] << " [--inline=N] [--shake] [--keep=Function.name]... [--policy=speed|size] <in dir> <out dir>" << endl;
+        return 1;
+    }
+
+    vector<fs::path> files;
+    for (auto& e : fs::directory_iterator(paths[0]))
+        if (e.path().extension() == ".vm") files.push_back(e.path());
+    sort(files.begin(), files.end());
+
+    vector<Module> mods;
+    try {
+        for (auto& f : files) mods.push_back(loadModule(f));
+    } catch (const exception& e) {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+
+    // Sys.init is the bootstrap target; programs without an OS start at Main.main.
+    roots.push_back("Sys.init");
+    bool hasSysInit = false;
+    for (auto& m : mods) for (auto& f : m.funcs) hasSysInit |= f.name == "Sys.init";
+    if (!hasSysInit) roots.push_back("Main.main");
+
+    if (inlineSize > 0) inlineCalls(mods, inlineSize);
+    if (doShake) shake(mods, roots, policy);
+
+    fs::path outDir(paths[1]);
+    fs::create_directories(outDir);
+    for (auto& m : mods) {
+        if (m.funcs.empty() && m.prologue.empty()) continue;
+        ofstream out(outDir / m.file);
+        for (auto& c : m.prologue) writeCmd(out, c);
+        for (auto& f : m.funcs) for (auto& c : f.body) writeCmd(out, c);
+    }
+    return 0;
+}
@@ -0,0 +1,433 @@
+#include <bits/stdc++.h>
+#include <filesystem>
+using namespace std;
+namespace fs = std::filesystem;
+
+// Runs VM programs directly: every .vm file of a directory is loaded into one
+// bytecode array with labels, calls and statics resolved at load time, and
+// executed on a Hack-shaped RAM (SP/LCL/ARG/THIS/THAT at 0..4, stack from 256).
+// Selected OS classes can be bound to native C++ implementations.
+
+enum Op : uint8_t {
+    O_PUSHC, O_PUSHI, O_PUSHD, O_POPI, O_POPD,
+    O_ADD, O_SUB, O_NEG, O_EQ, O_GT, O_LT, O_AND, O_OR, O_NOT,
+    O_GOTO, O_IF, O_FUNCTION, O_CALL, O_NATIVE, O_RETURN
+};
+
+// PUSHI/POPI address RAM[RAM[a] + b] (a is LCL/ARG/THIS/THAT);
+// PUSHD/POPD address RAM[a] directly (static/temp/pointer).
+struct Ins {
+    Op op;
+    int32_t a = 0;
+    int32_t b = 0;
+};
+
+struct Func {
+    string name;
+    int entry = -1;
+    int native = -1;
+};
+
+enum { SP = 0, LCL = 1, ARG = 2, THIS = 3, THAT = 4 };
+
+struct VM {
+    vector<Ins> code;
+    vector<Func> funcs;
+    unordered_map<string,int> funcIndex;
+    vector<int16_t> ram = vector<int16_t>(32768);
+    int nextStatic = 16;
+    bool halted = false;
+    string out;
+
+    int funcId(const string& name) {
+        auto it = funcIndex.find(name);
+        if (it != funcIndex.end()) return it->second;
+        funcIndex[name] = (int)funcs.size();
+        funcs.push_back({name});
+        return (int)funcs.size() - 1;
+    }
+
+    static void trim(string& s) {
+        size_t p = s.find("//");
+        if (p != string::npos) s.erase(p);
+        size_t l = s.find_first_not_of(" \t\r\n");
+        if (l == string::npos) { s.clear(); return; }
+        size_t r = s.find_last_not_of(" \t\r\n");
+        s = s.substr(l, r - l + 1);
+    }
+
+    [[noreturn]] static void fail(const string& file, int line, const string& m) {
+        throw runtime_error(file + ":" + to_string(line) + ": " + m);
+    }
+
+    // Label targets are patched once the enclosing function has been read.
+    void load(const string& file) {
+        ifstream in(file);
+        if (!in) throw runtime_error("cannot open input: " + file);
+        unordered_map<int,int> statics;
+        unordered_map<string,int> labels;
+        vector<pair<int,string>> fixups;
+        string cur = "";
+        auto resolve = [&] {
+            for (auto& [pc, L] : fixups) {
+                auto it = labels.find(L);
+                if (it == labels.end()) throw runtime_error(file + ": undefined label " + cur + "$" + L);
+                code[pc].a = it->second;
+            }
+            fixups.clear(); labels.clear();
+        };
+        string line;
+        int lineNo = 0;
+        while (getline(in, line)) {
+            ++lineNo;
+            trim(line);
+            if (line.empty()) continue;
+            istringstream ss(line);
+            string cmd, a1; int a2 = 0;
+            ss >> cmd >> a1 >> a2;
+            Ins I{O_ADD};
+            if (cmd == "push" || cmd == "pop") {
+                bool push = cmd == "push";
+                if (a1 == "constant") {
+                    if (!push) fail(file, lineNo, "pop constant");
+                    I = {O_PUSHC, a2};
+                } else if (a1 == "local" || a1 == "argument" || a1 == "this" || a1 == "that") {
+                    int reg = a1 == "local" ? LCL : a1 == "argument" ? ARG : a1 == "this" ? THIS : THAT;
+                    I = {push ? O_PUSHI : O_POPI, reg, a2};
+                } else {
+                    int addr;
+                    if (a1 == "static") {
+                        auto it = statics.find(a2);
+                        if (it == statics.end()) it = statics.emplace(a2, nextStatic++).first;
+                        addr = it->second;
+                    } else if (a1 == "temp") addr = 5 + a2;
+                    else if (a1 == "pointer") addr = 3 + a2;
+                    else fail(file, lineNo, "unknown segment " + a1);
+                    I = {push ? O_PUSHD : O_POPD, addr};
+                }
+            } else if (cmd == "label") {
+                labels[a1] = (int)code.size();
+                continue;
+            } else if (cmd == "goto" || cmd == "if-goto") {
+                fixups.push_back({(int)code.size(), a1});
+                I = {cmd == "goto" ? O_GOTO : O_IF};
+            } else if (cmd == "function") {
+                resolve();
+                cur = a1;
+                Func& f = funcs[funcId(a1)];
+                if (f.entry >= 0) fail(file, lineNo, "duplicate function " + a1);
+                f.entry = (int)code.size();
+                I = {O_FUNCTION, funcId(a1), a2};
+            } else if (cmd == "call") {
+                I = {O_CALL, funcId(a1), a2};
+            } else if (cmd == "return") {
+                I = {O_RETURN};
+            } else {
+                static const unordered_map<string,Op> ops = {
+                    {"add",O_ADD},{"sub",O_SUB},{"neg",O_NEG},{"eq",O_EQ},{"gt",O_GT},
+                    {"lt",O_LT},{"and",O_AND},{"or",O_OR},{"not",O_NOT}
+                };
+                auto it = ops.find(cmd);
+                if (it == ops.end()) fail(file, lineNo, "unknown command " + cmd);
+                I = {it->second};
+            }
+            code.push_back(I);
+        }
+        resolve();
+    }
+
+    // --- native OS ---
+
+    typedef int16_t (*Native)(VM&, int16_t*);
+    vector<pair<string,Native>> natives;
+    set<string> nativeClasses;
+    int heapFree = 2048;          // first-fit free list over RAM[2048..16383]: [size, next]
+
+    static int16_t nDivide(VM& vm, int16_t* a) {
+        if (a[1] == 0) { vm.out += "ERR3"; vm.halted = true; return 0; }
+        return (int16_t)(a[0] / a[1]);
+    }
+    static int16_t nAlloc(VM& vm, int16_t* a) {
+        int size = a[0];
+        if (size <= 0) { vm.out += "ERR5"; vm.halted = true; return 0; }
+        for (int prev = -1, b = vm.heapFree; b != 0; prev = b, b = vm.ram[b + 1]) {
+            int bs = vm.ram[b];
+            if (bs < size + 1) continue;
+            if (bs >= size + 3) {
+                int rest = b + size + 1;
+                vm.ram[rest] = (int16_t)(bs - size - 1);
+                vm.ram[rest + 1] = vm.ram[b + 1];
+                vm.ram[b] = (int16_t)(size + 1);
+                if (prev < 0) vm.heapFree = rest; else vm.ram[prev + 1] = (int16_t)rest;
+            } else {
+                if (prev < 0) vm.heapFree = vm.ram[b + 1]; else vm.ram[prev + 1] = vm.ram[b + 1];
+            }
+            return (int16_t)(b + 1);
+        }
+        vm.out += "ERR6"; vm.halted = true; return 0;
+    }
+    static int16_t nDeAlloc(VM& vm, int16_t* a) {
+        int b = ((uint16_t)a[0] - 1) & 32767;
+        at(vm, b + 1) = (int16_t)vm.heapFree;
+        vm.heapFree = b;
+        return 0;
+    }
+    // RAM word at a pointer computed by a native, wrapped like Memory.peek/poke.
+    static int16_t& at(VM& vm, int addr) { return vm.ram[(uint16_t)addr & 32767]; }
+
+    // Strings are [maxLength, length, chars...] on the native heap.
+    static int16_t nStrNew(VM& vm, int16_t* a) {
+        int16_t n = a[0];
+        if (n < 0) { vm.out += "ERR14"; vm.halted = true; return 0; }
+        int16_t args[1] = {(int16_t)(n + 2)};
+        int16_t s = nAlloc(vm, args);
+        if (vm.halted) return 0;
+        vm.ram[s] = n; vm.ram[s + 1] = 0;
+        return s;
+    }
+    static int16_t nStrAppend(VM& vm, int16_t* a) {
+        int s = (uint16_t)a[0];
+        if (at(vm, s + 1) >= at(vm, s)) { vm.out += "ERR17"; vm.halted = true; return a[0]; }
+        at(vm, s + 2 + at(vm, s + 1)++) = a[1];
+        return a[0];
+    }
+    static int16_t nStrCharAt(VM& vm, int16_t* a) {
+        int s = (uint16_t)a[0];
+        if (a[1] < 0 || a[1] >= at(vm, s + 1)) { vm.out += "ERR15"; vm.halted = true; return 0; }
+        return at(vm, s + 2 + a[1]);
+    }
+    static int16_t nStrSetCharAt(VM& vm, int16_t* a) {
+        int s = (uint16_t)a[0];
+        if (a[1] < 0 || a[1] >= at(vm, s + 1)) { vm.out += "ERR16"; vm.halted = true; return 0; }
+        at(vm, s + 2 + a[1]) = a[2];
+        return 0;
+    }
+    static int16_t nStrIntValue(VM& vm, int16_t* a) {
+        int s = (uint16_t)a[0], n = at(vm, s + 1), i = 0, v = 0;
+        bool neg = n > 0 && at(vm, s + 2) == '-';
+        if (neg) i = 1;
+        for (; i < n && isdigit(at(vm, s + 2 + i)); ++i) v = v * 10 + (at(vm, s + 2 + i) - '0');
+        return (int16_t)(neg ? -v : v);
+    }
+    static int16_t nStrSetInt(VM& vm, int16_t* a) {
+        int s = (uint16_t)a[0];
+        string d = to_string((int)a[1]);
+        if ((int)d.size() > at(vm, s)) { vm.out += "ERR19"; vm.halted = true; return 0; }
+        for (size_t i = 0; i < d.size(); ++i) at(vm, s + 2 + (int)i) = d[i];
+        at(vm, s + 1) = (int16_t)d.size();
+        return 0;
+    }
+    // Output goes to the host's stdout as text rather than to the screen bitmap.
+    static void putChar(VM& vm, int c) {
+        if (c == 128) vm.out += '\n';
+        else if (c == 129) { if (!vm.out.empty() && vm.out.back() != '\n') vm.out.pop_back(); }
+        else vm.out += (char)c;
+    }
+    static int16_t nPrintString(VM& vm, int16_t* a) {
+        int s = (uint16_t)a[0];
+        for (int i = 0; i < at(vm, s + 1); ++i) putChar(vm, at(vm, s + 2 + i));
+        return 0;
+    }
+
+    void bindNatives(const set<string>& classes) {
+        nativeClasses = classes;
+        if (classes.count("Array") || classes.count("String") || classes.count("Output")) nativeClasses.insert("Memory");
+        if (classes.count("Output")) nativeClasses.insert("String");
+        if (nativeClasses.count("Memory")) {
+            ram[2048] = 16384 - 2048; ram[2049] = 0;
+        }
+        natives = {
+            {"Math.init",        [](VM&, int16_t*) -> int16_t { return 0; }},
+            {"Math.multiply",    [](VM&, int16_t* a) -> int16_t { return (int16_t)(a[0] * a[1]); }},
+            {"Math.divide",      nDivide},
+            {"Math.abs",         [](VM&, int16_t* a) -> int16_t { return (int16_t)abs(a[0]); }},
+            {"Math.min",         [](VM&, int16_t* a) -> int16_t { return min(a[0], a[1]); }},
+            {"Math.max",         [](VM&, int16_t* a) -> int16_t { return max(a[0], a[1]); }},
+            {"Math.sqrt",        [](VM& vm, int16_t* a) -> int16_t {
+                if (a[0] < 0) { vm.out += "ERR4"; vm.halted = true; return 0; }
+                return (int16_t)sqrt((double)a[0]); }},
+            {"Memory.init",      [](VM&, int16_t*) -> int16_t { return 0; }},
+            {"Memory.peek",      [](VM& vm, int16_t* a) -> int16_t { return vm.ram[(uint16_t)a[0] & 32767]; }},
+            {"Memory.poke",      [](VM& vm, int16_t* a) -> int16_t { vm.ram[(uint16_t)a[0] & 32767] = a[1]; return 0; }},
+            {"Memory.alloc",     nAlloc},
+            {"Memory.deAlloc",   nDeAlloc},
+            {"Array.new",        nAlloc},
+            {"Array.dispose",    nDeAlloc},
+            {"String.new",       nStrNew},
+            {"String.dispose",   nDeAlloc},
+            {"String.length",    [](VM& vm, int16_t* a) -> int16_t { return at(vm, (uint16_t)a[0] + 1); }},
+            {"String.charAt",    nStrCharAt},
+            {"String.setCharAt", nStrSetCharAt},
+            {"String.appendChar",nStrAppend},
+            {"String.eraseLastChar", [](VM& vm, int16_t* a) -> int16_t { if (at(vm, (uint16_t)a[0] + 1) > 0) at(vm, (uint16_t)a[0] + 1)--; return 0; }},
+            {"String.intValue",  nStrIntValue},
+            {"String.setInt",    nStrSetInt},
+            {"String.newLine",   [](VM&, int16_t*) -> int16_t { return 128; }},
+            {"String.backSpace", [](VM&, int16_t*) -> int16_t { return 129; }},
+            {"String.doubleQuote", [](VM&, int16_t*) -> int16_t { return 34; }},
+            {"Output.init",      [](VM&, int16_t*) -> int16_t { return 0; }},
+            {"Output.moveCursor",[](VM&, int16_t*) -> int16_t { return 0; }},
+            {"Output.printChar", [](VM& vm, int16_t* a) -> int16_t { putChar(vm, a[0]); return 0; }},
+            {"Output.printString", nPrintString},
+            {"Output.printInt",  [](VM& vm, int16_t* a) -> int16_t { vm.out += to_string((int)a[0]); return 0; }},
+            {"Output.println",   [](VM& vm, int16_t*) -> int16_t { vm.out += '\n'; return 0; }},
+            {"Output.backSpace", [](VM& vm, int16_t*) -> int16_t { putChar(vm, 129); return 0; }},
+        };
+        for (size_t i = 0; i < natives.size(); ++i) {
+            const string& name = natives[i].first;
+            if (!nativeClasses.count(name.substr(0, name.find('.')))) continue;
+            funcs[funcId(name)].native = (int)i;
+        }
+    }
+
+    // --- execution ---
+
+    vector<uint64_t> profile;     // VM instructions executed per function
+
+    void link() {
+        for (auto& I : code) {
+            if (I.op != O_CALL) continue;
+            const Func& f = funcs[I.a];
+            if (f.native >= 0) I.op = O_NATIVE;
+            else if (f.entry < 0) throw runtime_error("undefined function " + f.name);
+        }
+    }
+
+    // Returns the number of VM instructions executed.
+    uint64_t run(int entry, uint64_t maxSteps) {
+        ram[SP] = 256;
+        int haltId = funcIndex.count("Sys.halt") ? funcIndex["Sys.halt"] : -1;
+        profile.assign(funcs.size(), 0);
+        vector<pair<int,int>> frames;   // caller and return pc; RAM only holds a 16-bit copy of the pc
+        int cur = -1;
+        int16_t* R = ram.data();
+        auto push = [&](int16_t v) { R[R[SP]++] = v; };
+        auto pop = [&]() -> int16_t { return R[--R[SP]]; };
+        auto callFrame = [&](int f, int nArgs, int ret) {
+            push((int16_t)ret); push(R[LCL]); push(R[ARG]); push(R[THIS]); push(R[THAT]);
+            R[ARG] = (int16_t)(R[SP] - nArgs - 5);
+            R[LCL] = R[SP];
+            frames.push_back({cur, ret});
+            cur = f;
+            return funcs[f].entry;
+        };
+        int pc = callFrame(entry, 0, -1);
+        uint64_t steps = 0;
+        while (steps < maxSteps && !halted) {
+            if (pc < 0) { halted = true; break; }
+            const Ins& I = code[pc++];
+            ++steps;
+            ++profile[cur];
+            switch (I.op) {
+                case O_PUSHC: push((int16_t)I.a); break;
+                case O_PUSHI: push(R[(uint16_t)(R[I.a] + I.b) & 32767]); break;
+                case O_PUSHD: push(R[I.a]); break;
+                case O_POPI:  { int16_t v = pop(); R[(uint16_t)(R[I.a] + I.b) & 32767] = v; break; }
+                case O_POPD:  R[I.a] = pop(); break;
+                case O_ADD: { int16_t y = pop(); R[R[SP]-1] = (int16_t)(R[R[SP]-1] + y); break; }
+                case O_SUB: { int16_t y = pop(); R[R[SP]-1] = (int16_t)(R[R[SP]-1] - y); break; }
+                case O_AND: { int16_t y = pop(); R[R[SP]-1] &= y; break; }
+                case O_OR:  { int16_t y = pop(); R[R[SP]-1] |= y; break; }
+                case O_EQ:  { int16_t y = pop(); R[R[SP]-1] = R[R[SP]-1] == y ? -1 : 0; break; }
+                case O_GT:  { int16_t y = pop(); R[R[SP]-1] = R[R[SP]-1] > y ? -1 : 0; break; }
+                case O_LT:  { int16_t y = pop(); R[R[SP]-1] = R[R[SP]-1] < y ? -1 : 0; break; }
+                case O_NEG: R[R[SP]-1] = (int16_t)-R[R[SP]-1]; break;
+                case O_NOT: R[R[SP]-1] = (int16_t)~R[R[SP]-1]; break;
+                case O_GOTO: pc = I.a; break;
+                case O_IF:   if (pop() != 0) pc = I.a; break;
+                case O_FUNCTION:
+                    if (I.a == haltId) { halted = true; break; }
+                    for (int i = 0; i < I.b; ++i) push(0);
+                    break;
+                case O_CALL:
+                    if (I.a == haltId) { halted = true; break; }
+                    pc = callFrame(I.a, I.b, pc);
+                    break;
+                case O_NATIVE: {
+                    int16_t* args = R + R[SP] - I.b;
+                    int16_t v = natives[funcs[I.a].native].second(*this, args);
+                    if (halted) break;          // leave the failing call's frame as it was
+                    R[SP] = (int16_t)(R[SP] - I.b);
+                    push(v);
+                    break;
+                }
+                case O_RETURN: {
+                    int frame = R[LCL];
+                    R[R[ARG]] = pop();
+                    R[SP] = (int16_t)(R[ARG] + 1);
+                    R[THAT] = R[frame - 1]; R[THIS] = R[frame - 2];
+                    R[ARG] = R[frame - 3];  R[LCL] = R[frame - 4];
+                    cur = frames.back().first;
+                    pc = frames.back().second;
+                    frames.pop_back();
+                    break;
+                }
+            }
+        }
+        return steps;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    string inPath;
+    set<string> nativeClasses;
+    uint64_t maxSteps = UINT64_MAX;
+    bool showProfile = false;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--native") nativeClasses = {"Math", "Memory", "Array", "String", "Output"};
+        else if (a.rfind("--native=", 0) == 0) {
+            stringstream ss(a.substr(9));
+            for (string c; getline(ss, c, ','); ) nativeClasses.insert(c);
+        }
+        else if (a.rfind("--max-steps=", 0) == 0) maxSteps = stoull(a.substr(12));
+        else if (a == "--profile") showProfile = true;
+        else inPath = a;
+    }
+    if (inPath.empty()) {
+        cerr << "Usage: " << argv[0] << " [--native[=Math,Memory,Array,String,Output]] [--max-steps=N] [--profile] <file.vm | directory>" << endl;
+        return 1;
+    }
+
+    vector<string> files;
+    if (fs::is_directory(inPath)) {
+        for (auto& e : fs::directory_iterator(inPath))
+            if (e.path().extension() == ".vm") files.push_back(e.path().string());
+        sort(files.begin(), files.end());
+    } else {
+        files.push_back(inPath);
+    }
+
+    VM vm;
+    uint64_t steps = 0;
+    auto t0 = chrono::steady_clock::now();
+    try {
+        for (const auto& f : files) vm.load(f);
+        vm.bindNatives(nativeClasses);
+        // Without an OS Sys.init (e.g. fully native OS), start at Main.main.
+        string entry = vm.funcIndex.count("Sys.init") && vm.funcs[vm.funcIndex["Sys.init"]].entry >= 0 ? "Sys.init" : "Main.main";
+        vm.link();
+        if (vm.funcs[vm.funcId(entry)].entry < 0) throw runtime_error("no Sys.init or Main.main");
+        steps = vm.run(vm.funcId(entry), maxSteps);
+    } catch (const exception& e) {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    cout << vm.out;
+    if (!vm.out.empty() && vm.out.back() != '\n') cout << '\n';
+    cerr << (vm.halted ? "halted" : "stopped") << " after " << steps << " VM instructions in "
+         << fixed << setprecision(3) << secs << " s" << endl;
+    if (showProfile) {
+        map<string,uint64_t> byClass;
+        for (size_t i = 0; i < vm.funcs.size() && i < vm.profile.size(); ++i)
+            byClass[vm.funcs[i].name.substr(0, vm.funcs[i].name.find('.'))] += vm.profile[i];
+        vector<pair<uint64_t,string>> rows;
+        for (auto& [c, n] : byClass) if (n) rows.push_back({n, c});
+        sort(rows.rbegin(), rows.rend());
+        for (auto& [n, c] : rows)
+            cerr << setw(12) << n << "  " << setw(5) << setprecision(1) << 100.0 * n / max<uint64_t>(steps, 1) << "%  " << c << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,776 @@
+// Gate-level HDL front end shared by the native chip simulators: a parser for
+// the LAB1-LAB5 .hdl files, a flattener that expands a chip down to Nand and
+// DFF primitives, and a player for the .tst/.cmp test scripts.
+//
+// Built-in chips: Nand and DFF are the primitives; ROM32K and Keyboard stay
+// behavioural (a ROM array and an input register). Screen, ARegister and
+// DRegister have no .hdl in the labs, so they are given small HDL bodies here
+// (two RAM4Ks, and a plain Register) and expand to gates like everything else.
+//
+// Script state accessors such as RAM16K[5] or ARegister[] address the DFFs of
+// the first instance of that chip. A RAM's words are located by part order: the
+// LAB3 RAMs declare the part selected by address value i as their i-th part, so
+// in depth-first order word k is DFFs 16k..16k+15.
+#ifndef LABS_HDL_H
+#define LABS_HDL_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hdl {
+
+struct Pin {
+    std::string name;
+    int width;
+};
+
+struct Chip {
+    enum Kind { HDL, NAND, DFF, ROM32K, KEYBOARD };
+    // A part connection pin[pinLo..pinHi] = sig[sigLo..sigHi]; sig < 0 is a constant.
+    struct Conn {
+        int pin;
+        bool out;
+        int pinLo, pinHi;
+        int sig;
+        int sigLo, sigHi;
+    };
+    struct Part {
+        int chip;
+        std::vector<Conn> conns;
+    };
+    static constexpr int FALSE = -1, TRUE = -2;
+
+    std::string name;
+    Kind kind = HDL;
+    std::vector<Pin> in, out;
+    std::vector<Pin> signals;       // IN pins, then OUT pins, then internal pins
+    std::vector<Part> parts;
+
+    int pinIndex(const std::vector<Pin>& pins, const std::string& n) const {
+        for (size_t i = 0; i < pins.size(); ++i)
+            if (pins[i].name == n) return static_cast<int>(i);
+        return -1;
+    }
+};
+
+// Chips by name, loaded on first use from a list of directories.
+class Library {
+public:
+    explicit Library(std::vector<std::string> dirs) : dirs_(std::move(dirs)) {}
+
+    const Chip& operator[](int i) const { return chips_[i]; }
+
+    int find(const std::string& name) {
+        auto it = index_.find(name);
+        if (it != index_.end()) {
+            if (it->second < 0) throw std::runtime_error("chip " + name + " is part of itself");
+            return it->second;
+        }
+        index_[name] = -1;
+        Chip c;
+        if (name == "Nand") {
+            c = primitive(name, Chip::NAND, {{"a", 1}, {"b", 1}}, {{"out", 1}});
+        } else if (name == "DFF") {
+            c = primitive(name, Chip::DFF, {{"in", 1}}, {{"out", 1}});
+        } else if (name == "ROM32K") {
+            c = primitive(name, Chip::ROM32K, {{"address", 15}}, {{"out", 16}});
+        } else if (name == "Keyboard") {
+            c = primitive(name, Chip::KEYBOARD, {}, {{"out", 16}});
+        } else {
+            std::string text;
+            for (const std::string& d : dirs_) {
+                std::ifstream f(d + "/" + name + ".hdl");
+                if (!f) continue;
+                std::stringstream ss;
+                ss << f.rdbuf();
+                text = ss.str();
+                break;
+            }
+            if (text.empty()) text = builtinSource(name);
+            if (text.empty()) throw std::runtime_error("no " + name + ".hdl in the search path");
+            c = parse(text, name);
+        }
+        chips_.push_back(std::move(c));
+        int id = static_cast<int>(chips_.size() - 1);
+        index_[name] = id;
+        return id;
+    }
+
+private:
+    std::vector<std::string> dirs_;
+    std::vector<Chip> chips_;
+    std::map<std::string, int> index_;
+
+    static Chip primitive(const std::string& name, Chip::Kind k, std::vector<Pin> in, std::vector<Pin> out) {
+        Chip c;
+        c.name = name;
+        c.kind = k;
+        c.in = std::move(in);
+        c.out = std::move(out);
+        c.signals = c.in;
+        c.signals.insert(c.signals.end(), c.out.begin(), c.out.end());
+        return c;
+    }
+
+    static std::string builtinSource(const std::string& name) {
+        if (name == "Screen")
+            return "CHIP Screen { IN in[16], load, address[13]; OUT out[16]; PARTS:"
+                   " DMux(in=load, sel=address[12], a=loada, b=loadb);"
+                   " RAM4K(in=in, load=loada, address=address[0..11], out=outa);"
+                   " RAM4K(in=in, load=loadb, address=address[0..11], out=outb);"
+                   " Mux16(a=outa, b=outb, sel=address[12], out=out); }";
+        if (name == "ARegister" || name == "DRegister")
+            return "CHIP " + name + " { IN in[16], load; OUT out[16]; PARTS: Register(in=in, load=load, out=out); }";
+        return "";
+    }
+
+    static std::vector<std::string> tokenize(const std::string& text) {
+        std::vector<std::string> t;
+        for (size_t i = 0; i < text.size();) {
+            char c = text[i];
+            if (isspace(static_cast<unsigned char>(c))) { ++i; continue; }
+            if (text.compare(i, 2, "//") == 0) { i = text.find('\n', i); if (i == std::string::npos) break; continue; }
+            if (text.compare(i, 2, "/*") == 0) { i = text.find("*/", i + 2); if (i == std::string::npos) break; i += 2; continue; }
+            if (text.compare(i, 2, "..") == 0) { t.push_back(".."); i += 2; continue; }
+            if (isalnum(static_cast<unsigned char>(c)) || c == '_') {
+                size_t j = i;
+                while (j < text.size() && (isalnum(static_cast<unsigned char>(text[j])) || text[j] == '_')) ++j;
+                t.push_back(text.substr(i, j - i));
+                i = j;
+                continue;
+            }
+            t.push_back(std::string(1, c));
+            ++i;
+        }
+        return t;
+    }
+
+    Chip parse(const std::string& text, const std::string& file) {
+        std::vector<std::string> t = tokenize(text);
+        size_t p = 0;
+        auto fail = [&](const std::string& what) -> void {
+            throw std::runtime_error(file + ".hdl: " + what + (p < t.size() ? " near '" + t[p] + "'" : " at end"));
+        };
+        auto peek = [&]() -> const std::string& { static const std::string end; return p < t.size() ? t[p] : end; };
+        auto next = [&]() { if (p >= t.size()) fail("unexpected end"); return t[p++]; };
+        auto expect = [&](const std::string& s) { if (next() != s) { --p; fail("expected '" + s + "'"); } };
+        auto number = [&]() {
+            std::string n = next();
+            if (n.empty() || !isdigit(static_cast<unsigned char>(n[0]))) { --p; fail("expected a number"); }
+            return std::stoi(n);
+        };
+        auto pins = [&](std::vector<Pin>& into) {
+            do {
+                Pin pin{next(), 1};
+                if (peek() == "[") { ++p; pin.width = number(); expect("]"); }
+                into.push_back(pin);
+            } while (peek() == "," && ++p);
+            expect(";");
+        };
+        // [i] or [i..j], or the whole pin
+        auto range = [&](int& lo, int& hi) {
+            lo = -1, hi = -1;
+            if (peek() != "[") return;
+            ++p;
+            lo = hi = number();
+            if (peek() == "..") { ++p; hi = number(); }
+            expect("]");
+        };
+
+        Chip c;
+        expect("CHIP");
+        c.name = next();
+        c.kind = Chip::HDL;
+        expect("{");
+        if (peek() == "IN") { ++p; pins(c.in); }
+        if (peek() == "OUT") { ++p; pins(c.out); }
+        if (peek() == "BUILTIN") fail("built-in chip without a gate-level body");
+        expect("PARTS");
+        expect(":");
+        c.signals = c.in;
+        c.signals.insert(c.signals.end(), c.out.begin(), c.out.end());
+
+        struct Pending { Chip::Conn conn; std::string sig; size_t pos; };
+        std::vector<std::vector<Pending>> pending;
+        while (peek() != "}") {
+            Chip::Part part;
+            part.chip = find(next());
+            pending.emplace_back();
+            expect("(");
+            do {
+                Pending pc;
+                std::string pinName = next();
+                range(pc.conn.pinLo, pc.conn.pinHi);
+                expect("=");
+                pc.pos = p;
+                pc.sig = next();
+                range(pc.conn.sigLo, pc.conn.sigHi);
+                const Chip& sub = chips_[part.chip];
+                pc.conn.out = false;
+                pc.conn.pin = sub.pinIndex(sub.in, pinName);
+                if (pc.conn.pin < 0) { pc.conn.out = true; pc.conn.pin = sub.pinIndex(sub.out, pinName); }
+                if (pc.conn.pin < 0) { p = pc.pos - 2; fail(sub.name + " has no pin " + pinName); }
+                int w = (pc.conn.out ? sub.out : sub.in)[pc.conn.pin].width;
+                if (pc.conn.pinLo < 0) pc.conn.pinLo = 0, pc.conn.pinHi = w - 1;
+                if (pc.conn.pinHi >= w || pc.conn.pinLo > pc.conn.pinHi) { p = pc.pos; fail("bad sub-bus of " + pinName); }
+                pending.back().push_back(pc);
+            } while (peek() == "," && ++p);
+            expect(")");
+            expect(";");
+            c.parts.push_back(part);
+        }
+        expect("}");
+
+        // Internal pins take the width of the part output that drives them.
+        for (size_t i = 0; i < c.parts.size(); ++i) {
+            for (Pending& pc : pending[i]) {
+                if (!pc.conn.out || c.pinIndex(c.signals, pc.sig) >= 0) continue;
+                if (pc.conn.sigLo >= 0) { p = pc.pos; fail("sub-bus of internal pin " + pc.sig); }
+                c.signals.push_back({pc.sig, pc.conn.pinHi - pc.conn.pinLo + 1});
+            }
+        }
+        for (size_t i = 0; i < c.parts.size(); ++i) {
+            for (Pending& pc : pending[i]) {
+                Chip::Conn& k = pc.conn;
+                p = pc.pos;
+                int width = k.pinHi - k.pinLo + 1;
+                if (pc.sig == "true" || pc.sig == "false") {
+                    if (k.out) fail("output connected to a constant");
+                    k.sig = pc.sig == "true" ? Chip::TRUE : Chip::FALSE;
+                    k.sigLo = 0, k.sigHi = width - 1;
+                } else {
+                    k.sig = c.pinIndex(c.signals, pc.sig);
+                    if (k.sig < 0) fail("undefined pin " + pc.sig);
+                    if (k.out && k.sig < static_cast<int>(c.in.size())) fail("output connected to input pin " + pc.sig);
+                    if (k.sigLo < 0) k.sigLo = 0, k.sigHi = c.signals[k.sig].width - 1;
+                    if (k.sigHi >= c.signals[k.sig].width || k.sigLo > k.sigHi) fail("bad sub-bus of " + pc.sig);
+                }
+                if (k.sigHi - k.sigLo + 1 != width) fail("width mismatch on " + pc.sig);
+                c.parts[i].conns.push_back(k);
+            }
+        }
+        return c;
+    }
+};
+
+// A chip expanded to primitives. Net 0 is false and net 1 is true; nets that no
+// gate drives (inputs, DFF and Keyboard outputs) hold whatever was last stored.
+struct Netlist {
+    struct Nand { uint32_t a, b, out; };
+    struct Dff { uint32_t in, out; };
+    struct Rom { std::vector<uint32_t> address, out; };
+    struct Port { std::string name; std::vector<uint32_t> bits; };
+
+    uint32_t nets = 2;
+    std::vector<Nand> nands;
+    std::vector<Dff> dffs;
+    std::vector<Rom> roms;
+    std::vector<std::vector<uint32_t>> keyboards;
+    std::vector<Port> inputs, outputs;
+    // partition of each primitive: one per instance of a split chip, 0 for the rest
+    std::vector<uint32_t> nandPart, dffPart, romPart;
+    uint32_t partitions = 1;
+    // DFF range of the first instance of each chip, in depth-first order
+    std::map<std::string, std::pair<uint32_t, uint32_t>> instances;
+
+    const Port* port(const std::string& name) const {
+        for (auto* v : {&inputs, &outputs})
+            for (const Port& p : *v)
+                if (p.name == name) return &p;
+        return nullptr;
+    }
+
+    // First DFF of word index (-1: the chip's only word) of the first instance of chip.
+    bool word(const std::string& chip, int index, uint32_t& first) const {
+        auto it = instances.find(chip);
+        if (it == instances.end() || it->second.second == it->second.first) return false;
+        uint32_t words = std::max<uint32_t>(1, (it->second.second - it->second.first) / 16);
+        if (index < 0) index = 0;
+        if (static_cast<uint32_t>(index) >= words) return false;
+        first = it->second.first + 16 * index;
+        return true;
+    }
+
+    // Topological order of the combinational primitives: Nand i as i, ROM j as
+    // nands.size() + j. Throws on a combinational loop.
+    std::vector<uint32_t> order(std::vector<uint32_t>* levelOut = nullptr) const {
+        size_t n = nands.size() + roms.size();
+        std::vector<uint32_t> driver(nets, UINT32_MAX);
+        for (uint32_t i = 0; i < nands.size(); ++i) driver[nands[i].out] = i;
+        for (uint32_t j = 0; j < roms.size(); ++j)
+            for (uint32_t o : roms[j].out) driver[o] = static_cast<uint32_t>(nands.size() + j);
+        auto inputsOf = [&](uint32_t g, std::vector<uint32_t>& v) {
+            v.clear();
+            if (g < nands.size()) { v.push_back(nands[g].a); v.push_back(nands[g].b); }
+            else v = roms[g - nands.size()].address;
+        };
+        std::vector<uint32_t> level(n, 0);
+        std::vector<uint8_t> state(n, 0);   // 0 new, 1 on the stack, 2 done
+        std::vector<std::pair<uint32_t, size_t>> stack;
+        std::vector<uint32_t> ins;
+        for (uint32_t root = 0; root < n; ++root) {
+            if (state[root]) continue;
+            stack.push_back({root, 0});
+            state[root] = 1;
+            while (!stack.empty()) {
+                auto& [g, k] = stack.back();
+                inputsOf(g, ins);
+                if (k < ins.size()) {
+                    uint32_t d = driver[ins[k++]];
+                    if (d == UINT32_MAX) continue;
+                    if (state[d] == 1) throw std::runtime_error("combinational loop");
+                    if (state[d] == 0) { state[d] = 1; stack.push_back({d, 0}); }
+                    continue;
+                }
+                uint32_t lv = 0;
+                for (uint32_t in : ins)
+                    if (driver[in] != UINT32_MAX) lv = std::max(lv, level[driver[in]] + 1);
+                level[g] = lv;
+                state[g] = 2;
+                stack.pop_back();
+            }
+        }
+        // counting sort by level, stable so each level keeps expansion order
+        std::vector<uint32_t> start;
+        for (uint32_t lv : level) {
+            if (lv + 1 >= start.size()) start.resize(lv + 2, 0);
+            ++start[lv + 1];
+        }
+        for (size_t i = 1; i < start.size(); ++i) start[i] += start[i - 1];
+        std::vector<uint32_t> ord(n);
+        for (uint32_t i = 0; i < n; ++i) ord[start[level[i]]++] = i;
+        if (levelOut) *levelOut = std::move(level);
+        return ord;
+    }
+};
+
+// Expands chip `top` of lib. Every instance of a chip named in split starts a partition.
+inline Netlist flatten(Library& lib, const std::string& top, const std::set<std::string>& split = {}) {
+    Netlist nl;
+    std::vector<uint32_t> parent{0, 1};
+    auto fresh = [&]() { parent.push_back(nl.nets); return nl.nets++; };
+    auto root = [&](uint32_t x) {
+        while (parent[x] != x) x = parent[x] = parent[parent[x]];
+        return x;
+    };
+
+    using Bus = std::vector<uint32_t>;
+    std::vector<uint8_t> seen, splits;   // by chip id: instantiated yet, in split (2 = not looked up)
+    std::function<std::vector<Bus>(int, const std::vector<Bus>&, uint32_t)> expand =
+        [&](int id, const std::vector<Bus>& in, uint32_t part) -> std::vector<Bus> {
+        const Chip& c = lib[id];
+        if (static_cast<size_t>(id) >= seen.size()) seen.resize(id + 1, 0);
+        bool first = !seen[id];
+        seen[id] = 1;
+        uint32_t dffStart = static_cast<uint32_t>(nl.dffs.size());
+        std::vector<Bus> out(c.out.size());
+        switch (c.kind) {
+        case Chip::NAND:
+            out[0] = {fresh()};
+            nl.nands.push_back({in[0][0], in[1][0], out[0][0]});
+            nl.nandPart.push_back(part);
+            break;
+        case Chip::DFF:
+            out[0] = {fresh()};
+            nl.dffs.push_back({in[0][0], out[0][0]});
+            nl.dffPart.push_back(part);
+            break;
+        case Chip::ROM32K:
+            for (int i = 0; i < 16; ++i) out[0].push_back(fresh());
+            nl.roms.push_back({in[0], out[0]});
+            nl.romPart.push_back(part);
+            break;
+        case Chip::KEYBOARD:
+            for (int i = 0; i < 16; ++i) out[0].push_back(fresh());
+            nl.keyboards.push_back(out[0]);
+            break;
+        case Chip::HDL: {
+            std::vector<Bus> local(c.signals.size());
+            // a part output drives one of this chip's pins: make them the same net
+            auto unite = [&](uint32_t pin, uint32_t driver, const Chip::Conn& k) {
+                uint32_t x = root(pin), y = root(driver);
+                if (x == y) return;
+                if (x < 2) throw std::runtime_error(c.name + ": pin " + c.signals[k.sig].name + " has two drivers");
+                parent[x] = y;
+            };
+            for (size_t s = 0; s < c.signals.size(); ++s) {
+                if (s < c.in.size()) { local[s] = in[s]; continue; }
+                for (int b = 0; b < c.signals[s].width; ++b) local[s].push_back(fresh());
+            }
+            for (const Chip::Part& p : c.parts) {
+                const Chip& sub = lib[p.chip];
+                uint32_t subPart = part;
+                if (static_cast<size_t>(p.chip) >= splits.size()) splits.resize(p.chip + 1, 2);
+                if (splits[p.chip] == 2) splits[p.chip] = split.count(sub.name) ? 1 : 0;
+                if (splits[p.chip]) subPart = nl.partitions++;
+                auto bit = [&](const Chip::Conn& k, int b) {
+                    return k.sig == Chip::TRUE ? 1u : k.sig == Chip::FALSE ? 0u : local[k.sig][k.sigLo + b];
+                };
+                if (sub.kind == Chip::NAND || sub.kind == Chip::DFF) {   // the bulk of the netlist: no recursion
+                    uint32_t pin[2] = {0, 0}, o = fresh();
+                    for (const Chip::Conn& k : p.conns)
+                        if (!k.out) pin[k.pin] = bit(k, 0);
+                    if (sub.kind == Chip::NAND) {
+                        nl.nands.push_back({pin[0], pin[1], o});
+                        nl.nandPart.push_back(subPart);
+                    } else {
+                        nl.dffs.push_back({pin[0], o});
+                        nl.dffPart.push_back(subPart);
+                    }
+                    for (const Chip::Conn& k : p.conns)
+                        if (k.out) unite(local[k.sig][k.sigLo], o, k);
+                    continue;
+                }
+                std::vector<Bus> subIn(sub.in.size());
+                for (size_t i = 0; i < sub.in.size(); ++i) subIn[i].assign(sub.in[i].width, 0);
+                for (const Chip::Conn& k : p.conns) {
+                    if (k.out) continue;
+                    for (int b = 0; b <= k.pinHi - k.pinLo; ++b)
+                        subIn[k.pin][k.pinLo + b] = bit(k, b);
+                }
+                std::vector<Bus> subOut = expand(p.chip, subIn, subPart);
+                for (const Chip::Conn& k : p.conns) {
+                    if (!k.out) continue;
+                    for (int b = 0; b <= k.pinHi - k.pinLo; ++b) unite(local[k.sig][k.sigLo + b], subOut[k.pin][k.pinLo + b], k);
+                }
+            }
+            for (size_t o = 0; o < c.out.size(); ++o) out[o] = local[c.in.size() + o];
+            break;
+        }
+        }
+        if (first) nl.instances[c.name] = {dffStart, static_cast<uint32_t>(nl.dffs.size())};
+        return out;
+    };
+
+    int id = lib.find(top);
+    const Chip& c = lib[id];
+    std::vector<Bus> in(c.in.size());
+    for (size_t i = 0; i < c.in.size(); ++i)
+        for (int b = 0; b < c.in[i].width; ++b) in[i].push_back(fresh());
+    std::vector<Bus> out = expand(id, in, 0);
+    for (size_t i = 0; i < c.in.size(); ++i) nl.inputs.push_back({c.in[i].name, in[i]});
+    for (size_t i = 0; i < c.out.size(); ++i) nl.outputs.push_back({c.out[i].name, out[i]});
+
+    // Renumber the surviving nets densely, keeping 0 and 1 as the constants.
+    std::vector<uint32_t> dense(nl.nets, UINT32_MAX);
+    uint32_t n = 0;
+    for (uint32_t x = 0; x < nl.nets; ++x)
+        if (root(x) == x) dense[x] = n++;
+    auto map = [&](uint32_t& x) { x = dense[root(x)]; };
+    std::vector<uint8_t> driven(n, 0);
+    auto drive = [&](uint32_t x) {
+        if (x < 2 || driven[x]++) throw std::runtime_error(top + ": a pin has two drivers");
+    };
+    for (auto& g : nl.nands) { map(g.a); map(g.b); map(g.out); drive(g.out); }
+    for (auto& d : nl.dffs) { map(d.in); map(d.out); drive(d.out); }
+    for (auto& r : nl.roms) { for (auto& x : r.address) map(x); for (auto& x : r.out) { map(x); drive(x); } }
+    for (auto& k : nl.keyboards) for (auto& x : k) { map(x); drive(x); }
+    for (auto* v : {&nl.inputs, &nl.outputs})
+        for (auto& p : *v) for (auto& x : p.bits) map(x);
+    nl.nets = n;
+    return nl;
+}
+
+// The chip a script loads ("load ALU.hdl" -> "ALU"), or "" if it loads none.
+inline std::string scriptChip(const std::string& file) {
+    std::ifstream f(file);
+    for (std::string w, prev; f >> w; prev = w) {
+        if (prev != "load") continue;
+        size_t dot = w.find(".hdl");
+        return dot == std::string::npos ? "" : w.substr(0, dot);
+    }
+    return "";
+}
+
+// Where a script's chips are looked up: its own directory, then the LAB1-LAB5
+// chip directories of the labs tree it sits in.
+inline std::vector<std::string> searchPath(const std::string& file) {
+    size_t slash = file.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : file.substr(0, slash);
+    std::vector<std::string> path{dir};
+    std::string up = dir;
+    for (int i = 0; i < 3; ++i, up += "/..") {
+        if (!std::ifstream(up + "/LAB1/Nand.hdl") && !std::ifstream(up + "/LAB1/Not.hdl")) continue;
+        for (const char* d : {"LAB1", "LAB2", "LAB3/a", "LAB3/b", "LAB5"}) path.push_back(up + "/" + d);
+        break;
+    }
+    return path;
+}
+
+// Reads a .hack file (one 16-bit binary word per line) into rom, zeroing the rest.
+inline bool loadHack(const std::string& file, std::vector<uint16_t>& rom) {
+    std::ifstream in(file);
+    if (!in) return false;
+    std::fill(rom.begin(), rom.end(), 0);
+    std::string line;
+    for (size_t i = 0; i < rom.size() && std::getline(in, line);) {
+        while (!line.empty() && isspace(static_cast<unsigned char>(line.back()))) line.pop_back();
+        if (line.empty()) continue;
+        rom[i++] = static_cast<uint16_t>(std::stoul(line, nullptr, 2));
+    }
+    return true;
+}
+
+// The chip side of a test script.
+class Target {
+public:
+    virtual ~Target() = default;
+    virtual int width(const std::string& pin) = 0;          // -1 if there is no such pin
+    virtual void set(const std::string& pin, uint64_t value) = 0;
+    virtual uint64_t get(const std::string& pin) = 0;
+    // Built-in state: chip[index], index -1 for chip[]. Returns false if there is none.
+    virtual bool getState(const std::string& chip, int index, uint64_t& value) = 0;
+    virtual bool setState(const std::string& chip, int index, uint64_t value) = 0;
+    virtual bool loadRom(const std::string& file) = 0;
+    virtual void eval() = 0;
+    virtual void tick() = 0;
+    virtual void tock() = 0;
+};
+
+// Plays a .tst script against a Target: load, output-file, compare-to,
+// output-list, set, eval, tick, tock, ticktock, output, repeat, echo and
+// ROM32K load. Output goes to the output file, as the nand2tetris simulator
+// does, and each line is checked against the compare file ('*' matches any
+// character there).
+class Script {
+public:
+    Script(Target& t, std::string file) : t_(t), file_(std::move(file)) {
+        size_t slash = file_.find_last_of('/');
+        dir_ = slash == std::string::npos ? "." : file_.substr(0, slash);
+    }
+
+    // Runs the whole script; returns the number of lines that differ from the compare file.
+    int run() {
+        std::ifstream f(file_);
+        if (!f) throw std::runtime_error("cannot open " + file_);
+        std::stringstream ss;
+        ss << f.rdbuf();
+        tokens_ = tokenize(ss.str());
+        pos_ = 0;
+        block(tokens_.size());
+        return mismatches_;
+    }
+
+    uint64_t cycles() const { return time_; }
+    int lines() const { return lines_; }
+
+private:
+    struct Column { std::string name; int index = -2; char fmt = 'B'; int left = 1, width = 1, right = 1; };
+
+    Target& t_;
+    std::string file_, dir_;
+    std::vector<std::string> tokens_;
+    size_t pos_ = 0;
+    std::vector<Column> columns_;
+    std::ofstream out_;
+    std::vector<std::string> cmp_;
+    uint64_t time_ = 0;
+    bool half_ = false;
+    int lines_ = 0, mismatches_ = 0;
+
+    static std::vector<std::string> tokenize(const std::string& text) {
+        std::vector<std::string> t;
+        for (size_t i = 0; i < text.size();) {
+            char c = text[i];
+            if (isspace(static_cast<unsigned char>(c))) { ++i; continue; }
+            if (text.compare(i, 2, "//") == 0) { i = text.find('\n', i); if (i == std::string::npos) break; continue; }
+            if (text.compare(i, 2, "/*") == 0) { i = text.find("*/", i + 2); if (i == std::string::npos) break; i += 2; continue; }
+            if (c == ',' || c == ';' || c == '{' || c == '}') { t.push_back(std::string(1, c)); ++i; continue; }
+            if (c == '"') {
+                size_t j = text.find('"', i + 1);
+                if (j == std::string::npos) j = text.size();
+                t.push_back(text.substr(i, j - i + 1));
+                i = j + 1;
+                continue;
+            }
+            size_t j = i;
+            while (j < text.size() && !isspace(static_cast<unsigned char>(text[j])) && !strchr(",;{}", text[j])) ++j;
+            t.push_back(text.substr(i, j - i));
+            i = j;
+        }
+        return t;
+    }
+
+    // Runs commands until `end` or a closing brace.
+    void block(size_t end) {
+        while (pos_ < end && tokens_[pos_] != "}") {
+            std::vector<std::string> cmd;
+            while (pos_ < tokens_.size() && tokens_[pos_] != "," && tokens_[pos_] != ";" && tokens_[pos_] != "{" &&
+                   tokens_[pos_] != "}")
+                cmd.push_back(tokens_[pos_++]);
+            if (pos_ < tokens_.size() && tokens_[pos_] == "{") {
+                if (cmd.size() != 2 || cmd[0] != "repeat") throw std::runtime_error(file_ + ": unsupported block " + join(cmd));
+                int n = std::stoi(cmd[1]);
+                size_t body = ++pos_;
+                for (int i = 0; i < n; ++i) {
+                    pos_ = body;
+                    block(tokens_.size());
+                }
+                if (n == 0) skipBlock();
+                if (pos_ >= tokens_.size() || tokens_[pos_] != "}") throw std::runtime_error(file_ + ": missing '}'");
+                ++pos_;
+                continue;
+            }
+            if (pos_ < tokens_.size() && tokens_[pos_] != "}") ++pos_;
+            if (!cmd.empty()) command(cmd);
+        }
+    }
+
+    void skipBlock() {
+        for (int depth = 0; pos_ < tokens_.size(); ++pos_) {
+            if (tokens_[pos_] == "{") ++depth;
+            if (tokens_[pos_] == "}" && depth-- == 0) return;
+        }
+    }
+
+    static std::string join(const std::vector<std::string>& v) {
+        std::string s;
+        for (auto& w : v) s += (s.empty() ? "" : " ") + w;
+        return s;
+    }
+
+    static uint64_t parseValue(const std::string& s) {
+        std::string v = s;
+        int base = 10;
+        if (v.size() > 1 && v[0] == '%') {
+            base = v[1] == 'B' ? 2 : v[1] == 'X' ? 16 : 10;
+            v = v.substr(2);
+        }
+        return static_cast<uint64_t>(std::stoll(v, nullptr, base));
+    }
+
+    // "RAM16K[5]" -> ("RAM16K", 5), "PC[]" -> ("PC", -1); index -2 for a plain pin
+    static std::pair<std::string, int> splitName(const std::string& s) {
+        size_t b = s.find('[');
+        if (b == std::string::npos) return {s, -2};
+        std::string idx = s.substr(b + 1, s.size() - b - 2);
+        return {s.substr(0, b), idx.empty() ? -1 : std::stoi(idx)};
+    }
+
+    void command(const std::vector<std::string>& c) {
+        const std::string& op = c[0];
+        if (op == "load") return;   // the target is already built
+        if (op == "echo" || op == "clear-echo") return;
+        if (op == "eval") { t_.eval(); return; }
+        if (op == "tick") { t_.tick(); half_ = true; return; }
+        if (op == "tock") { t_.tock(); half_ = false; ++time_; return; }
+        if (op == "ticktock") { t_.tick(); t_.tock(); ++time_; return; }
+        if (op == "output") { output(); return; }
+        if (op == "output-file" && c.size() == 2) {
+            out_.open(dir_ + "/" + c[1]);
+            if (!out_) throw std::runtime_error("cannot write " + dir_ + "/" + c[1]);
+            return;
+        }
+        if (op == "compare-to" && c.size() == 2) {
+            std::ifstream f(dir_ + "/" + c[1]);
+            if (!f) throw std::runtime_error("cannot open " + dir_ + "/" + c[1]);
+            for (std::string line; std::getline(f, line);) cmp_.push_back(trim(line));
+            return;
+        }
+        if (op == "output-list") {
+            columns_.clear();
+            for (size_t i = 1; i < c.size(); ++i) {
+                Column col;
+                size_t pct = c[i].find('%');
+                auto [name, index] = splitName(c[i].substr(0, pct));
+                col.name = c[i].substr(0, pct);
+                col.index = index;
+                if (pct != std::string::npos) {
+                    col.fmt = c[i][pct + 1];
+                    if (sscanf(c[i].c_str() + pct + 2, "%d.%d.%d", &col.left, &col.width, &col.right) != 3)
+                        throw std::runtime_error(file_ + ": bad format " + c[i]);
+                }
+                columns_.push_back(col);
+            }
+            std::string header = "|";
+            for (auto& col : columns_) {
+                int w = col.left + col.width + col.right;
+                std::string n = col.name.substr(0, w);
+                int l = (w - static_cast<int>(n.size())) / 2;
+                header += std::string(l, ' ') + n + std::string(w - l - n.size(), ' ') + "|";
+            }
+            emit(header);
+            return;
+        }
+        if (op == "set" && c.size() == 3) {
+            auto [name, index] = splitName(c[1]);
+            uint64_t v = parseValue(c[2]);
+            if (index == -2 && t_.width(name) >= 0) t_.set(name, v);
+            else if (!t_.setState(name, index, v)) throw std::runtime_error(file_ + ": cannot set " + c[1]);
+            return;
+        }
+        if (c.size() == 3 && c[1] == "load") {
+            std::string rom = c[2][0] == '/' ? c[2] : dir_ + "/" + c[2];
+            if (!t_.loadRom(rom)) throw std::runtime_error(file_ + ": cannot load " + c[2] + " into " + op);
+            return;
+        }
+        throw std::runtime_error(file_ + ": unsupported command '" + join(c) + "'");
+    }
+
+    static std::string trim(std::string s) {
+        while (!s.empty() && isspace(static_cast<unsigned char>(s.back()))) s.pop_back();
+        return s;
+    }
+
+    void output() {
+        std::string line = "|";
+        for (auto& col : columns_) {
+            std::string v;
+            if (col.name == "time") {
+                v = std::to_string(time_) + (half_ ? "+" : "");
+                v += std::string(std::max(0, col.width - static_cast<int>(v.size())), ' ');
+            } else {
+                auto [name, index] = splitName(col.name);
+                uint64_t x = 0;
+                int bits = 16;
+                if (index == -2 && (bits = t_.width(name)) >= 0) x = t_.get(name);
+                else if (!t_.getState(name, index, x)) throw std::runtime_error(file_ + ": no value for " + col.name);
+                else bits = 16;
+                if (col.fmt == 'B') {
+                    for (int i = col.width - 1; i >= 0; --i) v += (x >> i & 1) ? '1' : '0';
+                } else if (col.fmt == 'X') {
+                    char buf[32];
+                    snprintf(buf, sizeof buf, "%0*llX", col.width, static_cast<unsigned long long>(x));
+                    v = buf;
+                } else {
+                    long long d = static_cast<long long>(x);
+                    if (bits == 16 && (x & 0x8000)) d -= 0x10000;
+                    v = std::to_string(d);
+                    v = std::string(std::max(0, col.width - static_cast<int>(v.size())), ' ') + v;
+                }
+                if (static_cast<int>(v.size()) > col.width) v = v.substr(v.size() - col.width);
+            }
+            line += std::string(col.left, ' ') + v + std::string(col.right, ' ') + "|";
+        }
+        emit(line);
+    }
+
+    void emit(const std::string& line) {
+        if (out_.is_open()) out_ << line << "\n";
+        size_t n = lines_++;
+        if (n >= cmp_.size()) return;
+        const std::string& want = cmp_[n];
+        bool same = want.size() == line.size();
+        for (size_t i = 0; same && i < line.size(); ++i) same = want[i] == '*' || want[i] == line[i];
+        if (!same && ++mismatches_ <= 5)
+            fprintf(stderr, "%s: line %zu differs\n  got:      %s\n  expected: %s\n", file_.c_str(), n + 1, line.c_str(),
+                    want.c_str());
+    }
+};
+
+}  // namespace hdl
+
+#endif
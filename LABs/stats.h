@@ -0,0 +1,176 @@
+// Opt-in run statistics shared by the toolchain: wall time per phase, counters
+// (bytes, tokens, commands, symbols, ...) and peak RSS. Every tool accepts
+//
+//     --stats[=text|json][:FILE]
+//
+// and reports once as the process exits, on stderr or appended to FILE (one
+// line per run for json, so a file collects a history). While stats are off
+// every hook is a single branch.
+//
+// Tools that #include another tool inside a namespace (LAB10/parser.cpp,
+// LAB11/pipeline.cpp, LAB11/server.cpp) include this header first, at global
+// scope, so the whole process shares one Stats.
+#ifndef LABS_STATS_H
+#define LABS_STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+
+class Stats {
+    using Clock = std::chrono::steady_clock;
+
+public:
+    static Stats& get() {
+        static Stats s;
+        return s;
+    }
+
+    // Turns stats on when arg is the --stats flag; returns false for any other argument.
+    bool parseFlag(const std::string& arg, const char* tool) {
+        if (arg != "--stats" && arg.compare(0, 8, "--stats=") != 0) return false;
+        std::string spec = arg.size() > 8 ? arg.substr(8) : "";
+        size_t colon = spec.find(':');
+        std::string format = spec.substr(0, colon);
+        if (format == "json") json_ = true;
+        else if (format == "text" || format.empty()) json_ = false;
+        else return false;
+        file_ = colon == std::string::npos ? "" : spec.substr(colon + 1);
+        tool_ = tool;
+        on_ = true;
+        return true;
+    }
+    bool on() const { return on_; }
+
+    // Times a phase until it goes out of scope. Phases nested inside it on the
+    // same thread are not counted twice; phases on several threads add up.
+    class Timer {
+    public:
+        Timer(Stats* s, const char* phase) : s_(s), phase_(phase) {
+            if (!s_) return;
+            s_->bump(s_->phases_, phase_, 0);   // phases are listed in the order they start
+            parent_ = current();
+            current() = this;
+            t0_ = Clock::now();
+        }
+        ~Timer() {
+            if (!s_) return;
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0_).count();
+            current() = parent_;
+            if (parent_) parent_->nested_ += ms;
+            s_->bump(s_->phases_, phase_, ms - nested_);
+        }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        static Timer*& current() {
+            thread_local Timer* t = nullptr;
+            return t;
+        }
+        Stats* s_;
+        const char* phase_;
+        Timer* parent_ = nullptr;
+        double nested_ = 0;
+        Clock::time_point t0_;
+    };
+    Timer time(const char* phase) { return Timer(on_ ? this : nullptr, phase); }
+
+    void add(const char* counter, long long n) {
+        if (on_) bump(counters_, counter, static_cast<double>(n));
+    }
+    // Keeps the largest value seen, e.g. for table sizes.
+    void peak(const char* counter, long long n) {
+        if (!on_) return;
+        std::lock_guard<std::mutex> lock(m_);
+        slot(counters_, counter) = std::max(slot(counters_, counter), static_cast<double>(n));
+    }
+
+    // Hack instructions in assembly text: lines other than blanks, comments and labels.
+    static long long asmInstructions(std::string_view text) {
+        long long n = 0;
+        for (size_t i = 0; i < text.size(); ) {
+            size_t e = text.find('\n', i);
+            if (e == std::string_view::npos) e = text.size();
+            size_t b = text.find_first_not_of(" \t\r", i);
+            if (b < e && text[b] != '/' && text[b] != '(') ++n;
+            i = e + 1;
+        }
+        return n;
+    }
+
+    ~Stats() { report(); }
+
+private:
+    using Table = std::vector<std::pair<std::string, double>>;
+
+    bool on_ = false, json_ = false;
+    std::string tool_, file_;
+    Clock::time_point start_ = Clock::now();
+    std::mutex m_;
+    Table phases_, counters_;
+
+    static double& slot(Table& t, const char* name) {
+        for (auto& e : t)
+            if (e.first == name) return e.second;
+        t.emplace_back(name, 0.0);
+        return t.back().second;
+    }
+    void bump(Table& t, const char* name, double v) {
+        std::lock_guard<std::mutex> lock(m_);
+        slot(t, name) += v;
+    }
+
+    void report() {
+        if (!on_) return;
+        double wall = std::chrono::duration<double, std::milli>(Clock::now() - start_).count();
+        rusage u{};
+        getrusage(RUSAGE_SELF, &u);
+        std::string o;
+        char num[64];
+        if (json_) {
+            snprintf(num, sizeof num, "%lld", static_cast<long long>(std::time(nullptr)));
+            o = "{\"tool\":\"" + tool_ + "\",\"unix_time\":" + num;
+            snprintf(num, sizeof num, ",\"wall_ms\":%.3f,\"peak_rss_kb\":%ld", wall, u.ru_maxrss);
+            o += num;
+            o += ",\"phases_ms\":{";
+            for (size_t i = 0; i < phases_.size(); ++i) {
+                snprintf(num, sizeof num, "%s\"%s\":%.3f", i ? "," : "", phases_[i].first.c_str(), phases_[i].second);
+                o += num;
+            }
+            o += "},\"counters\":{";
+            for (size_t i = 0; i < counters_.size(); ++i) {
+                snprintf(num, sizeof num, "%s\"%s\":%.0f", i ? "," : "", counters_[i].first.c_str(), counters_[i].second);
+                o += num;
+            }
+            o += "}}\n";
+        } else {
+            snprintf(num, sizeof num, ": %.2f ms wall, peak RSS %ld KB\n", wall, u.ru_maxrss);
+            o = tool_ + num;
+            for (auto& p : phases_) {
+                snprintf(num, sizeof num, "  %-16s %10.2f ms\n", p.first.c_str(), p.second);
+                o += num;
+            }
+            for (auto& c : counters_) {
+                snprintf(num, sizeof num, "  %-16s %10.0f\n", c.first.c_str(), c.second);
+                o += num;
+            }
+        }
+        FILE* f = file_.empty() ? stderr : fopen(file_.c_str(), "a");
+        if (!f) {
+            fprintf(stderr, "stats: cannot open %s\n", file_.c_str());
+            f = stderr;
+        }
+        fputs(o.c_str(), f);
+        if (f != stderr) fclose(f);
+    }
+};
+
+#endif